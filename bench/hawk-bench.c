@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+
+//	hawk-bench --- made up /proc trees, and timing hawk -R against them
+//
+//	hawk-bench gen dir pids fds maps
+//		make dir look like /proc with that many processes, each with that
+//		many open fds and mappings, plus the system wide files hawk reads
+//	hawk-bench run hawk dir passes [hawk flags]
+//		run hawk -R dir and report its first pass, the passes after it,
+//		syscalls per pass and peak RSS
+//	hawk-bench same hawk [hawk flags]
+//		against the real /proc, check that an idle process with more
+//		mappings than fit in a page reads the same every pass, and
+//		so that hawk never takes part of a file for the whole of it
+//
+// A quarter of the processes come in groups of 8 with the same values, as
+// worker pools do, so clone_check has something to find.  Nothing in the
+// tree changes between passes, so the later passes measure the cost of
+// looking, not of reporting.
+
+#define	BUFSIZE		1024
+#define	FIRST_PID	100
+#define	POOL		8			// processes per group of clones
+#define	MAPS_PAGES	512			// pages mapped by same's idle process
+
+static void
+fail(const char *what)
+{
+	fprintf(stderr,"hawk-bench: %s: %s\n",what,strerror(errno));
+	exit(1);
+}
+
+// a path in a BUFSIZE buffer from a format, failing rather than cut it short
+static void
+make_path(char *path, const char *fmt, ...) __attribute__((format(printf,2,3)));
+
+static void
+make_path(char *path, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap,fmt);
+	n = vsnprintf(path,BUFSIZE,fmt,ap);
+	va_end(ap);
+	if( n < 0 || n >= BUFSIZE ){
+		errno = ENAMETOOLONG;
+		fail(path);	// what of it fits
+		}
+}
+
+// write a whole file at dir/name from a format
+static void
+put_file(const char *dir, const char *name, const char *fmt, ...) __attribute__((format(printf,3,4)));
+
+static void
+put_file(const char *dir, const char *name, const char *fmt, ...)
+{
+	char path[BUFSIZE];
+	va_list ap;
+	FILE *fp;
+
+	make_path(path,"%s/%s",dir,name);
+	if( (fp=fopen(path,"w")) == NULL )
+		fail(path);
+	va_start(ap,fmt);
+	vfprintf(fp,fmt,ap);
+	va_end(ap);
+	if( fclose(fp) != 0 )
+		fail(path);
+}
+
+// the same pseudo random numbers for the same seed
+static inline unsigned int
+mix(unsigned int seed, unsigned int n)
+{
+	unsigned int h = seed*2654435761u ^ n*40503u;
+
+	h ^= h >> 15;
+	h *= 2246822519u;
+	h ^= h >> 13;
+	return h;
+}
+
+static void
+gen_system(const char *root)
+{
+	static const char *slabs[] = { "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-96", "kmalloc-128",
+		"kmalloc-192", "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k", "kmalloc-4k", "kmalloc-8k",
+		"dentry", "inode_cache", "ext4_inode_cache", "proc_inode_cache", "sock_inode_cache", "radix_tree_node",
+		"buffer_head", "vm_area_struct", "mm_struct", "files_cache", "signal_cache", "sighand_cache",
+		"task_struct", "cred_jar", "anon_vma", "anon_vma_chain", "pid", "filp", "skbuff_head_cache",
+		"TCP", "UDP", "kernfs_node_cache", "shmem_inode_cache", "mnt_cache", "bio-0", "dquot", "eventpoll_epi" };
+	static const char *mem[] = { "MemTotal", "MemFree", "MemAvailable", "Buffers", "Cached", "SwapCached",
+		"Active", "Inactive", "Active(anon)", "Inactive(anon)", "Active(file)", "Inactive(file)", "Unevictable",
+		"Mlocked", "SwapTotal", "SwapFree", "Dirty", "Writeback", "AnonPages", "Mapped", "Shmem", "KReclaimable",
+		"Slab", "SReclaimable", "SUnreclaim", "KernelStack", "PageTables", "NFS_Unstable", "Bounce",
+		"WritebackTmp", "CommitLimit", "Committed_AS", "VmallocTotal", "VmallocUsed", "VmallocChunk", "Percpu",
+		"HardwareCorrupted", "AnonHugePages", "ShmemHugePages", "ShmemPmdMapped", "HugePages_Total",
+		"HugePages_Free", "HugePages_Rsvd", "HugePages_Surp", "Hugepagesize", "Hugetlb", "DirectMap4k",
+		"DirectMap2M", "DirectMap1G" };
+	static const char *vm[] = { "nr_free_pages", "nr_zone_inactive_anon", "nr_zone_active_anon",
+		"nr_zone_inactive_file", "nr_zone_active_file", "nr_zone_unevictable", "nr_zone_write_pending",
+		"nr_mlock", "nr_bounce", "nr_zspages", "nr_free_cma", "numa_hit", "numa_miss", "numa_foreign",
+		"numa_interleave", "numa_local", "numa_other", "nr_inactive_anon", "nr_active_anon", "nr_inactive_file",
+		"nr_active_file", "nr_unevictable", "nr_slab_reclaimable", "nr_slab_unreclaimable", "nr_isolated_anon",
+		"nr_isolated_file", "workingset_refault", "workingset_activate", "nr_anon_pages", "nr_mapped",
+		"nr_file_pages", "nr_dirty", "nr_writeback", "nr_shmem", "nr_dirtied", "nr_written", "pgpgin", "pgpgout",
+		"pswpin", "pswpout", "pgalloc_normal", "pgfree", "pgactivate", "pgdeactivate", "pgfault", "pgmajfault",
+		"pgrefill", "pgsteal_kswapd", "pgsteal_direct", "pgscan_kswapd", "pgscan_direct", "oom_kill",
+		"compact_stall", "compact_fail", "compact_success", "thp_fault_alloc", "thp_collapse_alloc" };
+	char path[BUFSIZE];
+	FILE *fp;
+	unsigned int i;
+
+	snprintf(path,sizeof(path),"%s/slabinfo",root);
+	if( (fp=fopen(path,"w")) == NULL )
+		fail(path);
+	fprintf(fp,"slabinfo - version: 2.1\n");
+	fprintf(fp,"# name            <active_objs> <num_objs> <objsize> <objperslab> <pagesperslab> : tunables <limit> <batchcount> <sharedfactor> : slabdata <active_slabs> <num_slabs> <sharedavail>\n");
+	for(i=0; i<sizeof(slabs)/sizeof(*slabs); i++)
+		fprintf(fp,"%-17s %6u %6u %4u %3u %2u : tunables    0    0    0 : slabdata %5u %5u      0\n",
+			slabs[i],mix(1,i)%100000,mix(1,i)%100000+64,64u<<(i%6),32,1,mix(2,i)%4000,mix(2,i)%4000);
+	fclose(fp);
+
+	snprintf(path,sizeof(path),"%s/meminfo",root);
+	if( (fp=fopen(path,"w")) == NULL )
+		fail(path);
+	for(i=0; i<sizeof(mem)/sizeof(*mem); i++)
+		fprintf(fp,"%-16s%8u kB\n",mem[i],mix(3,i)%16000000);	// %-16s leaves room for the :
+	fclose(fp);
+
+	snprintf(path,sizeof(path),"%s/vmstat",root);
+	if( (fp=fopen(path,"w")) == NULL )
+		fail(path);
+	for(i=0; i<sizeof(vm)/sizeof(*vm); i++)
+		fprintf(fp,"%s %u\n",vm[i],mix(4,i)%10000000);
+	fclose(fp);
+
+	snprintf(path,sizeof(path),"%s/stat",root);
+	if( (fp=fopen(path,"w")) == NULL )
+		fail(path);
+	fprintf(fp,"cpu  %u %u %u %u %u 0 %u 0 0 0\n",mix(5,0)%1000000,mix(5,1)%1000,mix(5,2)%100000,mix(5,3)%10000000,mix(5,4)%10000,mix(5,5)%1000);
+	for(i=0; i<8; i++)
+		fprintf(fp,"cpu%u %u %u %u %u %u 0 %u 0 0 0\n",i,mix(6,i)%100000,mix(7,i)%100,mix(8,i)%10000,mix(9,i)%1000000,mix(10,i)%1000,mix(11,i)%100);
+	fprintf(fp,"intr %u 0 9 0 0 0 0 0 0 0 0\nctxt %u\nbtime 1700000000\nprocesses %u\nprocs_running 2\nprocs_blocked 0\nsoftirq %u 0 0 0 0 0 0 0 0 0 0\n",
+		mix(12,0),mix(12,1),mix(12,2)%1000000,mix(12,3));
+	fclose(fp);
+
+	put_file(root,"diskstats",
+		"   8       0 sda %u 120 %u 3000 %u 40 %u 9000 0 10000 12000\n"
+		"   8       1 sda1 %u 100 %u 2800 %u 30 %u 8000 0 9000 11000\n"
+		" 259       0 nvme0n1 %u 0 %u 1200 %u 0 %u 4000 0 5000 5200\n",
+		mix(13,0)%100000,mix(13,1)%1000000,mix(13,2)%100000,mix(13,3)%1000000,
+		mix(13,4)%100000,mix(13,5)%1000000,mix(13,6)%100000,mix(13,7)%1000000,
+		mix(13,8)%100000,mix(13,9)%1000000,mix(13,10)%100000,mix(13,11)%1000000);
+}
+
+static void
+gen_proc(const char *root, unsigned int i, unsigned int npids, unsigned int nfds, unsigned int nmaps)
+{
+	static const char *libs[] = { "/usr/lib/x86_64-linux-gnu/libc.so.6", "/usr/lib/x86_64-linux-gnu/libm.so.6",
+		"/usr/lib/x86_64-linux-gnu/libpthread.so.0", "/usr/lib/x86_64-linux-gnu/ld-linux-x86-64.so.2",
+		"/usr/lib/x86_64-linux-gnu/libssl.so.3", "/usr/lib/x86_64-linux-gnu/libz.so.1", "[heap]", "" };
+	unsigned int pid = FIRST_PID+i;
+	// clones share their seed, and so all their values
+	unsigned int seed = i < npids/4 ? i/POOL : npids + i;
+	unsigned int vmsize = 20000 + mix(seed,1)%500000, rss = vmsize/4 + mix(seed,2)%(vmsize/2);
+	unsigned int threads = 1 + mix(seed,3)%16;
+	unsigned long long int addr;
+	char dir[BUFSIZE], path[BUFSIZE], link[BUFSIZE];
+	FILE *fp;
+	unsigned int n;
+
+	make_path(dir,"%s/%u",root,pid);
+	if( mkdir(dir,0755) < 0 )
+		fail(dir);
+
+	put_file(dir,"status",
+		"Name:\tworker%u\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%u\nNgid:\t0\nPid:\t%u\nPPid:\t1\nTracerPid:\t0\n"
+		"Uid:\t1000\t1000\t1000\t1000\nGid:\t1000\t1000\t1000\t1000\nFDSize:\t64\nGroups:\t1000\n"
+		"NStgid:\t%u\nNSpid:\t%u\nNSpgid:\t%u\nNSsid:\t%u\n"
+		"VmPeak:\t%8u kB\nVmSize:\t%8u kB\nVmLck:\t       0 kB\nVmPin:\t       0 kB\nVmHWM:\t%8u kB\nVmRSS:\t%8u kB\n"
+		"RssAnon:\t%8u kB\nRssFile:\t%8u kB\nRssShmem:\t       0 kB\nVmData:\t%8u kB\nVmStk:\t     132 kB\n"
+		"VmExe:\t%8u kB\nVmLib:\t%8u kB\nVmPTE:\t%8u kB\nVmSwap:\t       0 kB\nHugetlbPages:\t       0 kB\n"
+		"CoreDumping:\t0\nTHP_enabled:\t1\nThreads:\t%u\nSigQ:\t0/63382\nSigPnd:\t0000000000000000\n"
+		"ShdPnd:\t0000000000000000\nSigBlk:\t0000000000000000\nSigIgn:\t0000000000001000\n"
+		"SigCgt:\t0000000180004a02\nCapInh:\t0000000000000000\nCapPrm:\t0000000000000000\n"
+		"CapEff:\t0000000000000000\nCapBnd:\t000001ffffffffff\nCapAmb:\t0000000000000000\nNoNewPrivs:\t0\n"
+		"Seccomp:\t0\nSpeculation_Store_Bypass:\tthread vulnerable\nCpus_allowed:\tff\nCpus_allowed_list:\t0-7\n"
+		"Mems_allowed:\t00000001\nMems_allowed_list:\t0\nvoluntary_ctxt_switches:\t%u\nnonvoluntary_ctxt_switches:\t%u\n",
+		seed%1000,pid,pid,pid,pid,pid,pid,
+		vmsize+mix(seed,4)%1000,vmsize,rss+mix(seed,5)%1000,rss,
+		rss*3/4,rss/4,vmsize/2,
+		100+mix(seed,6)%2000,mix(seed,7)%20000,vmsize/500,
+		threads,mix(seed,8)%100000,mix(seed,9)%1000);
+
+	put_file(dir,"stat",
+		"%u (worker%u) S 1 %u %u 0 -1 4194560 %u 0 %u 0 %u %u 0 0 20 0 %u 0 %u %llu %u 18446744073709551615 "
+		"94000000000000 94000000100000 140730000000000 0 0 0 0 4096 19010 0 0 0 17 %u 0 0 0 0 0 "
+		"94000000200000 94000000300000 94000000400000 140730000100000 140730000100100 140730000100100 140730000200000 0\n",
+		pid,seed%1000,pid,pid,mix(seed,10)%100000,mix(seed,11)%100,mix(seed,12)%100000,mix(seed,13)%10000,
+		threads,mix(seed,14)%100000,(unsigned long long int)vmsize*1024,rss/4,mix(seed,15)%8);
+
+	put_file(dir,"comm","worker%u\n",seed%1000);
+	put_file(dir,"cgroup","0::/system.slice/worker%u.service\n",seed%100);
+
+	put_file(dir,"statm","%u %u %u %u 0 %u 0\n",vmsize/4,rss/4,rss/16,(100+mix(seed,6)%2000)/4,vmsize/8);
+
+	make_path(path,"%s/maps",dir);
+	if( (fp=fopen(path,"w")) == NULL )
+		fail(path);
+	addr = 0x55d4a0000000ULL + ((unsigned long long int)(seed%4096) << 24);
+	for(n=0; n<nmaps; n++){
+		unsigned long long int len = (1 + mix(seed,100+n)%64) << 12;
+		const char *lib = libs[n % (sizeof(libs)/sizeof(*libs))];
+
+		if( n == nmaps/2 )
+			addr = 0x7f0000000000ULL + ((unsigned long long int)(seed%4096) << 28);	// shared libraries up high
+		fprintf(fp,"%012llx-%012llx %s %08x %s %u%*s%s\n",addr,addr+len,n%3 ? "rw-p" : "r-xp",
+			lib[0]=='/' ? (n%4)<<12 : 0,lib[0]=='/' ? "08:01" : "00:00",lib[0]=='/' ? 1000+n : 0,
+			*lib ? 20 : 0,"",lib);
+		addr += len + 0x1000;
+		}
+	fclose(fp);
+
+	put_file(dir,"smaps_rollup",
+		"55d4a0000000-7ffd00000000 ---p 00000000 00:00 0                          [rollup]\n"
+		"Rss:            %8u kB\nPss:            %8u kB\nPss_Anon:       %8u kB\nPss_File:       %8u kB\n"
+		"Pss_Shmem:             0 kB\nShared_Clean:   %8u kB\nShared_Dirty:          0 kB\n"
+		"Private_Clean:  %8u kB\nPrivate_Dirty:  %8u kB\nReferenced:     %8u kB\nAnonymous:      %8u kB\n"
+		"LazyFree:              0 kB\nAnonHugePages:         0 kB\nShmemPmdMapped:        0 kB\n"
+		"FilePmdMapped:         0 kB\nShared_Hugetlb:        0 kB\nPrivate_Hugetlb:       0 kB\n"
+		"Swap:                  0 kB\nSwapPss:               0 kB\nLocked:                0 kB\n",
+		rss,rss*2/3,rss/2,rss/6,rss/4,rss/4,rss/2,rss,rss*3/4);
+
+	make_path(path,"%s/fd",dir);
+	if( mkdir(path,0700) < 0 )
+		fail(path);
+	for(n=0; n<nfds; n++){
+		switch(n < 3 ? 0 : n%4){
+		case 0: snprintf(link,sizeof(link),n ? "/dev/pts/%u" : "/dev/null",seed%8); break;
+		case 1: snprintf(link,sizeof(link),"socket:[%u]",mix(seed,200+n)%1000000); break;
+		case 2: snprintf(link,sizeof(link),"pipe:[%u]",mix(seed,200+n)%1000000); break;
+		default: snprintf(link,sizeof(link),"/var/log/worker%u.log",seed%1000); break;
+			}
+		make_path(path,"%s/fd/%u",dir,n);
+		if( symlink(link,path) < 0 )
+			fail(path);
+		}
+}
+
+static int
+gen(char **argv)
+{
+	unsigned int npids = atoi(argv[1]), nfds = atoi(argv[2]), nmaps = atoi(argv[3]), i;
+
+	if( mkdir(argv[0],0755) < 0 )
+		fail(argv[0]);
+	gen_system(argv[0]);
+	for(i=0; i<npids; i++)
+		gen_proc(argv[0],i,npids,nfds,nmaps);
+	return 0;
+}
+
+// count the syscalls of a traced child and its threads until it exits
+static long
+count_syscalls(pid_t child)
+{
+	long stops = 0;
+	int st, sig;
+	pid_t tid;
+
+	if( waitpid(child,&st,__WALL) < 0 || !WIFSTOPPED(st) )
+		return -1;	// not being traced after all
+	ptrace(PTRACE_SETOPTIONS,child,0,PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACECLONE|PTRACE_O_EXITKILL);
+	ptrace(PTRACE_SYSCALL,child,0,0);
+	while( (tid=waitpid(-1,&st,__WALL)) > 0 ){
+		if( !WIFSTOPPED(st) )
+			continue;	// a thread or the child itself went away
+		sig = WSTOPSIG(st);
+		if( sig == (SIGTRAP|0x80) ){
+			stops++;
+			sig = 0;
+			}
+		else if( sig == SIGTRAP || sig == SIGSTOP )	// clone events and new threads starting
+			sig = 0;
+		ptrace(PTRACE_SYSCALL,tid,0,sig);
+		}
+	return (stops+1)/2;	// a stop going in and one coming out, except for exit
+}
+
+// run hawk for some passes, return how long it took in ms
+static double
+run_hawk(char **argv, bool trace, long *syscalls, long *maxrss)
+{
+	struct timespec t0, t1;
+	struct rusage ru;
+	pid_t child;
+	int st, fd;
+
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	if( (child=fork()) < 0 )
+		fail("fork");
+	if( child == 0 ){
+		if( (fd=open("/dev/null",O_WRONLY)) >= 0 )
+			dup2(fd,1);
+		if( trace )
+			ptrace(PTRACE_TRACEME,0,0,0);
+		execv(argv[0],argv);
+		fail(argv[0]);
+		}
+	if( trace ){
+		*syscalls = count_syscalls(child);
+		if( *syscalls < 0 )
+			waitpid(child,&st,0);
+		return 0;
+		}
+	if( wait4(child,&st,0,&ru) < 0 )
+		fail("wait4");
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	if( !WIFEXITED(st) || WEXITSTATUS(st) != 0 ){
+		fprintf(stderr,"hawk-bench: %s failed\n",argv[0]);
+		exit(1);
+		}
+	*maxrss = ru.ru_maxrss;
+	return (t1.tv_sec-t0.tv_sec)*1000.0 + (t1.tv_nsec-t0.tv_nsec)/1e6;
+}
+
+static int
+run(int argc, char **argv)
+{
+	char passes[32], **hargv;
+	unsigned int npasses = atoi(argv[2]), npids = 0;
+	double first, all;
+	long sc1, scn, rss, rss1;
+	int i, n = 0;
+	DIR *d;
+
+	if( npasses < 1 )
+		npasses = 1;
+	// hawk -R dir -c passes [flags] 1ms, passes are back to back once they take over 1ms
+	if( (hargv=(char **)calloc(argc+6,sizeof(*hargv))) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	hargv[n++] = argv[0];
+	hargv[n++] = "-R";
+	hargv[n++] = argv[1];
+	hargv[n++] = "-c";
+	hargv[n++] = passes;
+	for(i=3; i<argc; i++)
+		hargv[n++] = argv[i];
+	hargv[n++] = "1ms";
+
+	snprintf(passes,sizeof(passes),"1");
+	first = run_hawk(hargv,false,NULL,&rss1);
+	run_hawk(hargv,true,&sc1,NULL);
+	snprintf(passes,sizeof(passes),"%u",npasses+1);
+	all = run_hawk(hargv,false,NULL,&rss);
+	run_hawk(hargv,true,&scn,NULL);
+
+	if( (d=opendir(argv[1])) != NULL ){
+		struct dirent *de;
+
+		while( (de=readdir(d)) != NULL )
+			if( atoi(de->d_name) > 0 )
+				npids++;
+		closedir(d);
+		}
+	printf("%7u pids: first pass %9.2f ms, then %9.2f ms/pass",npids,first,(all-first)/npasses);
+	if( sc1 >= 0 && scn >= 0 )
+		printf(", %8.0f syscalls/pass",(double)(scn-sc1)/npasses);
+	else
+		printf(", syscalls n/a");
+	printf(", max RSS %ld kB\n",rss > rss1 ? rss : rss1);
+	return 0;
+}
+
+// a process that sits still with its maps well over a page long
+static pid_t
+idle_child(void)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	char *mem;
+	pid_t child;
+	int i;
+
+	if( (child=fork()) < 0 )
+		fail("fork");
+	if( child > 0 )
+		return child;
+	// every other page writable, so each is a mapping of its own
+	if( (mem=(char *)mmap(NULL,MAPS_PAGES*page,PROT_READ,MAP_PRIVATE|MAP_ANONYMOUS,-1,0)) == MAP_FAILED )
+		fail("mmap");
+	for(i=0; i<MAPS_PAGES; i+=2)
+		mprotect(mem+i*page,page,PROT_READ|PROT_WRITE);
+	for(;;)
+		pause();
+}
+
+static int
+same(int argc, char **argv)
+{
+	char pid[32], **hargv, line[BUFSIZE];
+	pid_t child, hawk;
+	int i, n = 0, fds[2], st, pass = -1, changed = 0;
+	FILE *fp;
+
+	if( (hargv=(char **)calloc(argc+8,sizeof(*hargv))) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	child = idle_child();
+	snprintf(pid,sizeof(pid),"%d",(int)child);
+	hargv[n++] = argv[0];
+	hargv[n++] = "-P";
+	hargv[n++] = pid;
+	hargv[n++] = "-m";
+	hargv[n++] = "-v";
+	hargv[n++] = "-c";
+	hargv[n++] = "4";
+	for(i=1; i<argc; i++)
+		hargv[n++] = argv[i];
+	hargv[n++] = "100ms";
+
+	usleep(100000);		// let it make its mappings
+	if( pipe(fds) < 0 )
+		fail("pipe");
+	if( (hawk=fork()) < 0 )
+		fail("fork");
+	if( hawk == 0 ){
+		dup2(fds[1],1);
+		close(fds[0]);
+		execv(argv[0],hargv);
+		fail(argv[0]);
+		}
+	close(fds[1]);
+	if( (fp=fdopen(fds[0],"r")) == NULL )
+		fail("fdopen");
+	// the first pass shows everything, the ones after it (which have no
+	// header when empty) should show nothing
+	while( fgets(line,sizeof(line),fp) != NULL ){
+		if( strncmp(line,"=== Pass ",9) == 0 )
+			pass++;
+		else if( pass > 0 && atoi(line) == child ){
+			if( changed++ < 5 )
+				printf("%s",line);
+			}
+		}
+	fclose(fp);
+	kill(child,SIGKILL);
+	waitpid(child,&st,0);
+	if( waitpid(hawk,&st,0) < 0 || !WIFEXITED(st) || WEXITSTATUS(st) != 0 ){
+		fprintf(stderr,"hawk-bench: %s failed\n",argv[0]);
+		exit(1);
+		}
+	printf("%d lines changed for idle pid %s after the first pass: %s\n",changed,pid,changed ? "FAIL" : "ok");
+	return changed ? 1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	if( argc == 6 && strcmp(argv[1],"gen")==0 )
+		exit(gen(argv+2));
+	if( argc >= 5 && strcmp(argv[1],"run")==0 )
+		exit(run(argc-2,argv+2));
+	if( argc >= 3 && strcmp(argv[1],"same")==0 )
+		exit(same(argc-2,argv+2));
+	printf("Usage: hawk-bench gen dir pids fds maps\n");
+	printf("       hawk-bench run hawk dir passes [hawk flags]\n");
+	printf("       hawk-bench same hawk [hawk flags]\n");
+	exit(1);
+}
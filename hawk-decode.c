@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "hawkbin.h"
+
+//	hawk-decode --- turn hawk -B output back into the usual hawk text
+
+#define	UNDEF		"UNDEF"
+#define	MAXVAL		256			// longest string value hawk keeps
+#define	PHASH_SIZE	4096			// pid hash buckets, power of 2
+#define	VHASH_MIN	16			// initial per-pid value buckets, power of 2
+
+// last value printed for one name of one pid
+typedef struct dval {
+	struct dval	*next;
+	unsigned int	id;
+	bool		isint;
+	long long int	i;
+	char		s[MAXVAL];
+} dval_t;
+
+typedef struct dproc {
+	struct dproc	*next;
+	unsigned int	pid;
+	char		name[MAXVAL];	// process name as hawk shows it
+	dval_t		**vhash;
+	unsigned int	vhash_size;
+	unsigned int	vcount;
+} dproc_t;
+
+char	**Names = NULL;		// value names by id
+unsigned int	Nnames = 0;
+unsigned int	Name_id = -1;	// id of "Name", which is also the process name
+dproc_t	*Phash[PHASH_SIZE];
+
+unsigned int	Pass;
+time_t	Passtime;
+unsigned long long int	Passmono;	// milliseconds
+unsigned int	Passmissed;
+bool	Pass_printed;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+	if( (p=realloc(p,n)) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	return p;
+}
+
+static dproc_t *
+dproc_get(unsigned int pid)
+{
+	dproc_t *dp;
+
+	for(dp=Phash[pid & (PHASH_SIZE-1)]; dp; dp=dp->next)
+		if( dp->pid == pid )
+			return dp;
+	dp = (dproc_t *)xrealloc(NULL,sizeof(*dp));
+	memset(dp,0,sizeof(*dp));
+	dp->pid = pid;
+	dp->next = Phash[pid & (PHASH_SIZE-1)];
+	Phash[pid & (PHASH_SIZE-1)] = dp;
+	return dp;
+}
+
+// forget everything about a pid
+static void
+dproc_drop(unsigned int pid)
+{
+	dproc_t **dpp, *dp;
+	dval_t *dv, *dvn;
+	unsigned int i;
+
+	for(dpp = &Phash[pid & (PHASH_SIZE-1)]; (dp=*dpp) != NULL; dpp = &dp->next)
+		if( dp->pid == pid ){
+			*dpp = dp->next;
+			for(i=0; i<dp->vhash_size; i++)
+				for(dv=dp->vhash[i]; dv; dv=dvn){
+					dvn = dv->next;
+					free(dv);
+					}
+			free(dp->vhash);
+			free(dp);
+			return;
+			}
+}
+
+static dval_t *
+dval_get(dproc_t *dp, unsigned int id)
+{
+	dval_t *dv, *dvn, **old;
+	unsigned int i, oldsize;
+
+	if( dp->vhash_size )
+		for(dv=dp->vhash[id & (dp->vhash_size-1)]; dv; dv=dv->next)
+			if( dv->id == id )
+				return dv;
+	if( dp->vcount >= dp->vhash_size ){
+		old = dp->vhash;
+		oldsize = dp->vhash_size;
+		dp->vhash_size = oldsize ? oldsize*2 : VHASH_MIN;
+		dp->vhash = (dval_t **)xrealloc(NULL,dp->vhash_size*sizeof(*dp->vhash));
+		memset(dp->vhash,0,dp->vhash_size*sizeof(*dp->vhash));
+		for(i=0; i<oldsize; i++)
+			for(dv=old[i]; dv; dv=dvn){
+				dvn = dv->next;
+				dv->next = dp->vhash[dv->id & (dp->vhash_size-1)];
+				dp->vhash[dv->id & (dp->vhash_size-1)] = dv;
+				}
+		free(old);
+		}
+	dv = (dval_t *)xrealloc(NULL,sizeof(*dv));
+	dv->id = id;
+	dv->isint = false;
+	dv->i = 0;
+	strcpy(dv->s,UNDEF);
+	dv->next = dp->vhash[id & (dp->vhash_size-1)];
+	dp->vhash[id & (dp->vhash_size-1)] = dv;
+	dp->vcount++;
+	return dv;
+}
+
+static inline const char *
+name_str(unsigned long long int id)
+{
+	return id < Nnames && Names[id] ? Names[id] : "???";
+}
+
+static inline void
+show_pass(void)
+{
+	if( !Pass_printed ){
+		printf("=== Pass %d =================== %.24s mono %llu.%03u",Pass,ctime(&Passtime),Passmono/1000,(unsigned int)(Passmono%1000));
+		if( Passmissed )
+			printf(" missed %u",Passmissed);
+		printf("\n");
+		Pass_printed = true;
+		}
+}
+
+static inline void
+pid_display(dproc_t *dp)
+{
+	show_pass();
+	printf("%d %s ",dp->pid,dp->name);
+}
+
+// copy a value the way hawk keeps it, truncated to MAXVAL-1
+static inline void
+keep_str(char *to, const unsigned char *s, size_t len)
+{
+	if( len > MAXVAL-1 )
+		len = MAXVAL-1;
+	memcpy(to,s,len);
+	to[len] = '\0';
+}
+
+// decode one pass worth of records, return false if it is malformed
+static bool
+decode_block(const unsigned char *s, const unsigned char *end)
+{
+	unsigned long long int a, b, c, d, e;
+	dproc_t *dp = NULL;
+	dval_t *dv = NULL;
+	char old[MAXVAL], newval[MAXVAL];
+	long long int oldint, newint;
+	int tag, flags;
+
+	if( !get_varint(&s,end,&a) || !get_varint(&s,end,&b) || !get_varint(&s,end,&d) || !get_varint(&s,end,&e) )
+		return false;
+	if( a != Pass )	// hawk -e can send more than one block per pass
+		Pass_printed = false;
+	Pass = a;
+	Passtime = b;
+	Passmono = d;
+	Passmissed = e;
+
+	while( s < end ){
+		tag = *s++;
+		switch(tag){
+		case REC_NAME:
+			if( !get_varint(&s,end,&a) || !get_varint(&s,end,&b) || b > (unsigned long long int)(end-s) )
+				return false;
+			if( a >= Nnames ){
+				Names = (char **)xrealloc(Names,(a+1)*sizeof(*Names));
+				memset(&Names[Nnames],0,(a+1-Nnames)*sizeof(*Names));
+				Nnames = a+1;
+				}
+			free(Names[a]);
+			Names[a] = (char *)xrealloc(NULL,b+1);
+			memcpy(Names[a],s,b);
+			Names[a][b] = '\0';
+			if( strcmp(Names[a],"Name")==0 )
+				Name_id = a;
+			s += b;
+			break;
+		case REC_PID:
+			if( !get_varint(&s,end,&a) )
+				return false;
+			dp = dproc_get(a);
+			break;
+		case REC_NEW:
+		case REC_EXIT:
+			if( dp == NULL || s >= end )
+				return false;
+			flags = *s++;
+			if( tag == REC_NEW ){
+				a = dp->pid;
+				dproc_drop(a);
+				dp = dproc_get(a);
+				}
+			if( flags ){
+				pid_display(dp);
+				if( tag == REC_NEW )
+					printf("=================================================New\n");
+				else
+					printf("================================================================Exited\n");
+				}
+			if( tag == REC_EXIT ){
+				dproc_drop(dp->pid);
+				dp = NULL;
+				}
+			break;
+		case REC_CLONE:
+			if( dp == NULL || !get_varint(&s,end,&a) || !get_varint(&s,end,&b) )
+				return false;
+			pid_display(dp);
+			printf("%d%% clone of %d\n",(int)a,(int)b);
+			break;
+		case REC_INT:
+			if( dp == NULL || s >= end )
+				return false;
+			flags = *s++;
+			if( !get_varint(&s,end,&a) || !get_varint(&s,end,&b) )
+				return false;
+			dv = dval_get(dp,a);
+			pid_display(dp);
+			if( flags & REC_UNDEF ){
+				newint = unzigzag(b);
+				printf("%s %s %llx\n",name_str(a),UNDEF,newint);
+				}
+			else {
+				oldint = dv->i;
+				if( dv->isint )
+					sprintf(old,"%llx",oldint);
+				else
+					strcpy(old,dv->s);
+				newint = (long long int)((unsigned long long int)oldint + unzigzag(b));
+				if( newint > oldint )
+					printf("%s %s %llx +%llx\n",name_str(a),old,newint,newint-oldint);
+				else
+					printf("%s %s %llx -%llx\n",name_str(a),old,newint,oldint-newint);
+				}
+			dv->isint = true;
+			dv->i = newint;
+			break;
+		case REC_STR:
+			if( dp == NULL || s >= end )
+				return false;
+			flags = *s++;
+			if( !get_varint(&s,end,&a) || !get_varint(&s,end,&b) || b > (unsigned long long int)(end-s) )
+				return false;
+			c = b;
+			if( c > MAXVAL-1 )
+				c = MAXVAL-1;
+			keep_str(newval,s,c);
+			if( a == Name_id ){	// the process name itself
+				if( flags & REC_UNDEF )
+					keep_str(dp->name,s,b);	// hawk shows the new name straight away
+				strcpy(old,dp->name);
+				}
+			else {
+				dv = dval_get(dp,a);
+				if( dv->isint )
+					sprintf(old,"%llx",dv->i);
+				else
+					strcpy(old,dv->s);
+				}
+			pid_display(dp);
+			printf("%s %s ",name_str(a),(flags & REC_UNDEF) ? UNDEF : old);
+			if( b == 0 )
+				printf("%s\n",UNDEF);
+			else {
+				fwrite(s,1,b,stdout);
+				printf("\n");
+				}
+			if( b == 0 )
+				strcpy(newval,UNDEF);
+			if( a == Name_id )
+				strcpy(dp->name,newval);
+			else {
+				dv->isint = false;
+				strcpy(dv->s,newval);
+				}
+			s += b;
+			break;
+		case REC_MAP:	// mappings carry their old end, nothing to remember
+			if( dp == NULL || s >= end )
+				return false;
+			flags = *s++;
+			if( (flags & REC_UNDEF) && (flags & REC_GONE) )
+				return false;	// a mapping can't both appear and go
+			if( !get_varint(&s,end,&a) )
+				return false;
+			if( flags & REC_UNDEF ){	// appeared, just its end
+				if( !get_varint(&s,end,&c) )
+					return false;
+				pid_display(dp);
+				printf("Mmap-%016llx %s %llx\n",a,UNDEF,c);
+				break;
+				}
+			if( !get_varint(&s,end,&b) )
+				return false;
+			if( flags & REC_GONE ){	// went away, just its old end
+				pid_display(dp);
+				printf("Mmap-%016llx %llx %s\n",a,b,UNDEF);
+				break;
+				}
+			if( !get_varint(&s,end,&c) )
+				return false;
+			pid_display(dp);
+			if( c > b )
+				printf("Mmap-%016llx %llx %llx +%llx\n",a,b,c,c-b);
+			else
+				printf("Mmap-%016llx %llx %llx -%llx\n",a,b,c,b-c);
+			break;
+		case REC_TEXT:
+		case REC_LINE:
+			if( !get_varint(&s,end,&a) || a > (unsigned long long int)(end-s) )
+				return false;
+			if( tag == REC_LINE )
+				show_pass();
+			fwrite(s,1,a,stdout);
+			s += a;
+			break;
+		default:
+			return false;
+			}
+		}
+	return true;
+}
+
+// read a varint straight from the stream, return false at end of file
+static bool
+read_varint(FILE *fp, unsigned long long int *v)
+{
+	unsigned long long int r = 0;
+	int c, shift;
+
+	for(shift=0; shift<64; shift+=7){
+		if( (c=getc(fp)) == EOF )
+			return false;
+		r |= (unsigned long long int)(c & 0x7f) << shift;
+		if( (c & 0x80) == 0 ){
+			*v = r;
+			return true;
+			}
+		}
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	char magic[HAWKBIN_MAGICLEN];
+	unsigned char *buf = NULL;
+	size_t size = 0;
+	unsigned long long int len;
+
+	if( argc > 1 ){
+		printf("Usage: hawk-decode <hawk.bin >hawk.out\n");
+		exit(1);
+		}
+	if( fread(magic,1,sizeof(magic),stdin) != sizeof(magic) || memcmp(magic,HAWKBIN_MAGIC,HAWKBIN_MAGICLEN) != 0 ){
+		fprintf(stderr,"hawk-decode: not hawk -B output\n");
+		exit(1);
+		}
+	while( read_varint(stdin,&len) ){
+		if( len > size ){
+			size = len;
+			buf = (unsigned char *)xrealloc(buf,size);
+			}
+		if( fread(buf,1,len,stdin) != len ){
+			fprintf(stderr,"hawk-decode: truncated pass\n");
+			exit(1);
+			}
+		if( !decode_block(buf,buf+len) ){
+			fprintf(stderr,"hawk-decode: bad record in pass %d\n",Pass);
+			exit(1);
+			}
+		}
+	exit(0);
+}
@@ -0,0 +1,405 @@
+#define	_GNU_SOURCE	// getline
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+//	hawk-graph --- plot hawk output, like hawk_graph but in one pass over the log
+//
+// Reads hawk text output on stdin and leaves a png per process (and per kernel
+// area) in ./out.  Points are appended to each series' data file as they are
+// read, so memory use depends on the number of series, not the length of the
+// log.  gnuplot is then run on as many plots at a time as there are cpus.
+
+#define	OUTDIR		"out"
+#define	SHASH_MIN	1024			// initial series hash buckets, power of 2
+#define	BUFMAX		(8*1024*1024)		// data buffered across all series before writing the biggest out
+#define	MINPOINTS	3			// fewer points than this aren't worth plotting
+
+// one value of one process, a line in that process' plot
+typedef struct series {
+	struct series	*next;		// next in hash chain
+	unsigned int	hash;
+	char		*group;		// plot it is in: pid-name, or 0-kernel-AREA
+	char		*val;		// value name
+	unsigned long	count;		// lines seen, as hawk_graph counts them
+	int		pass;		// pass of the pending point, -1 if none
+	unsigned long long int	value;
+	char		*buf;		// points not yet written to its data file
+	size_t		len;
+	size_t		size;
+} series_t;
+
+series_t	**Shash = NULL;
+unsigned int	Shash_size = 0;
+unsigned int	Scount = 0;
+size_t	Buffered = 0;			// total of all series' len
+
+static void *
+xrealloc(void *p, size_t n)
+{
+	if( (p=realloc(p,n)) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	return p;
+}
+
+static char *
+xstrdup(const char *s)
+{
+	return strcpy((char *)xrealloc(NULL,strlen(s)+1),s);
+}
+
+static inline unsigned int
+series_hash(const char *group, const char *val)
+{
+	unsigned int h = 2166136261u;	// FNV-1a
+
+	while( *group )
+		h = (h ^ (unsigned char)*group++) * 16777619u;
+	h = (h ^ '-') * 16777619u;
+	while( *val )
+		h = (h ^ (unsigned char)*val++) * 16777619u;
+	return h;
+}
+
+static series_t *
+series_get(const char *group, const char *val)
+{
+	unsigned int h = series_hash(group,val), i, oldsize;
+	series_t *s, *sn, **old;
+
+	for(s=Shash[h & (Shash_size-1)]; s; s=s->next)
+		if( s->hash == h && strcmp(s->group,group)==0 && strcmp(s->val,val)==0 )
+			return s;
+	if( Scount >= Shash_size ){
+		old = Shash;
+		oldsize = Shash_size;
+		Shash_size *= 2;
+		Shash = (series_t **)xrealloc(NULL,Shash_size*sizeof(*Shash));
+		memset(Shash,0,Shash_size*sizeof(*Shash));
+		for(i=0; i<oldsize; i++)
+			for(s=old[i]; s; s=sn){
+				sn = s->next;
+				s->next = Shash[s->hash & (Shash_size-1)];
+				Shash[s->hash & (Shash_size-1)] = s;
+				}
+		free(old);
+		}
+	s = (series_t *)xrealloc(NULL,sizeof(*s));
+	memset(s,0,sizeof(*s));
+	s->hash = h;
+	s->group = xstrdup(group);
+	s->val = xstrdup(val);
+	s->pass = -1;
+	s->next = Shash[h & (Shash_size-1)];
+	Shash[h & (Shash_size-1)] = s;
+	Scount++;
+	return s;
+}
+
+// the file a series' points go in
+static inline void
+data_path(char *path, size_t size, series_t *s)
+{
+	snprintf(path,size,OUTDIR "/%s-%s",s->group,s->val);
+}
+
+// append what a series has buffered to its data file, and free the buffer
+// so one that was busy once doesn't keep its size
+static void
+series_write(series_t *s)
+{
+	char path[4096];
+	FILE *fp;
+
+	if( s->len == 0 )
+		return;
+	data_path(path,sizeof(path),s);
+	if( (fp=fopen(path,"a")) == NULL || fwrite(s->buf,1,s->len,fp) != s->len || fclose(fp) != 0 ){
+		fprintf(stderr,"hawk-graph: can't write %s\n",path);
+		exit(1);
+		}
+	Buffered -= s->len;
+	s->len = 0;
+	free(s->buf);
+	s->buf = NULL;
+	s->size = 0;
+}
+
+// move the pending point into the buffer, it can't be replaced by a later line any more
+static void
+series_point(series_t *s)
+{
+	if( s->pass < 0 )
+		return;
+	if( s->len + 64 > s->size ){
+		s->size = s->size ? s->size*2 : 256;
+		s->buf = (char *)xrealloc(s->buf,s->size);
+		}
+	Buffered -= s->len;
+	s->len += sprintf(s->buf+s->len,"%08d\t%llu\n",s->pass,s->value);
+	Buffered += s->len;
+	s->pass = -1;
+}
+
+// biggest buffer first
+static int
+series_lencmp(const void *a, const void *b)
+{
+	const series_t *sa = *(const series_t **)a, *sb = *(const series_t **)b;
+
+	return sa->len < sb->len ? 1 : sa->len > sb->len ? -1 : 0;
+}
+
+// write out the biggest buffers until half of BUFMAX is left, so each time a
+// data file is opened a good part of it is written, and the series with just
+// a few points wait for more
+static void
+flush_biggest(void)
+{
+	static series_t **big;
+	static unsigned int big_size;
+	series_t *s;
+	unsigned int i, n = 0;
+
+	if( big_size < Scount ){
+		big_size = Scount;
+		big = (series_t **)xrealloc(big,big_size*sizeof(*big));
+		}
+	for(i=0; i<Shash_size; i++)
+		for(s=Shash[i]; s; s=s->next)
+			if( s->len )
+				big[n++] = s;
+	qsort(big,n,sizeof(*big),series_lencmp);
+	for(i=0; i<n && Buffered > BUFMAX/2; i++)
+		series_write(big[i]);
+}
+
+// at the end of input, write out every series' buffer and pending point
+static void
+flush_all(void)
+{
+	series_t *s;
+	unsigned int i;
+
+	for(i=0; i<Shash_size; i++)
+		for(s=Shash[i]; s; s=s->next){
+			series_point(s);
+			series_write(s);
+			}
+}
+
+// one line of hawk output, split the way hawk_graph splits it
+static void
+take_line(char *line, int pass)
+{
+	char *f[5], *save, *dash, *val;
+	char group[4096];
+	series_t *s;
+	int n;
+
+	for(n=0; n<5; n++)
+		if( (f[n]=strtok_r(n ? NULL : line," \t\n",&save)) == NULL )
+			f[n] = "";
+	// Line is of the form: pid name value old new [delta]
+	if( strcmp(f[4],"UNDEF")==0 )		// new value UNDEF means it went away
+		return;
+	if( strcmp(f[2],"LEAK?")==0 )		// -L report, not a value
+		return;
+	if( strcmp(f[2],"EVICTED")==0 || strcmp(f[2],"TRIMMED")==0 || strcmp(f[2],"RETURNED")==0 )	// -M notice, not a value
+		return;
+	if( strncmp(f[2],"Fd",2)==0 && f[2][2] >= '0' && f[2][2] <= '9' )	// can't plot file descriptor names (FdCount is okay)
+		return;
+	if( strncmp(f[2],"Mmap",4)==0 )		// can't plot mmap areas
+		return;
+	for(save=f[1]; *save; save++)		// kworker threads have / in their names
+		if( *save == '/' )
+			*save = '-';
+	val = f[2];
+	if( strcmp(f[0],"0")==0 ){	// split the kernel's AREA-SUBAREA names into a graph per area
+		if( (dash=strchr(f[2],'-')) != NULL ){
+			*dash++ = '\0';
+			val = dash;
+			if( (dash=strchr(dash,'-')) != NULL )
+				*dash = '\0';
+			}
+		else
+			val = "";
+		snprintf(group,sizeof(group),"%s-%s-%s",f[0],f[1],f[2]);
+		}
+	else
+		snprintf(group,sizeof(group),"%s-%s",f[0],f[1]);
+
+	s = series_get(group,val);
+	s->count++;
+	if( s->pass != pass )
+		series_point(s);
+	s->pass = pass;				// a second line in the same pass replaces the first
+	s->value = strtoull(f[4],NULL,16);
+	if( Buffered > BUFMAX )
+		flush_biggest();
+}
+
+static int
+series_cmp(const void *a, const void *b)
+{
+	const series_t *sa = *(const series_t **)a, *sb = *(const series_t **)b;
+	int c;
+
+	if( (c=strcmp(sa->group,sb->group)) != 0 )
+		return c;
+	return strcmp(sa->val,sb->val);
+}
+
+// write the plot file for the series all[0..n-1] of one group, return false if none are plotted
+static bool
+write_plot(series_t **all, unsigned int n, int lastpass)
+{
+	char path[4096];
+	FILE *fp = NULL;
+	unsigned int i;
+	int style = 1;
+
+	for(i=0; i<n; i++){
+		if( all[i]->count < MINPOINTS )
+			continue;
+		if( fp == NULL ){
+			snprintf(path,sizeof(path),OUTDIR "/%s.plot",all[i]->group);
+			if( (fp=fopen(path,"w")) == NULL ){
+				fprintf(stderr,"hawk-graph: can't write %s\n",path);
+				exit(1);
+				}
+			fprintf(fp,"set terminal png giant size 1600,1200\n");
+			fprintf(fp,"set key below Left title 'Legend' box 3\n");
+			fprintf(fp,"set grid ytics linecolor rgb '#808080' linewidth 0.5\n");
+			fprintf(fp,"set pointsize 1.5\n");
+			fprintf(fp,"set xtics axis out\n");
+			fprintf(fp,"set ytics axis out\n");
+			fprintf(fp,"set xrange [0:%d]\n",lastpass);
+			fprintf(fp,"set yrange [0:*]\n");
+			fprintf(fp,"set xlabel \"Pass\"\n");
+			fprintf(fp,"set ylabel \"Value\"\n");
+			fprintf(fp,"plot ");
+			}
+		fprintf(fp,"\"%s-%s\" with linespoints linestyle %d, ",all[i]->group,all[i]->val,style++);
+		}
+	if( fp == NULL )
+		return false;
+	fprintf(fp,"\n");
+	fclose(fp);
+	return true;
+}
+
+// run gnuplot on out/group.plot in the background, making out/group.png
+static void
+plot_start(const char *group)
+{
+	char path[4096];
+	int fd;
+
+	switch(fork()){
+	case -1:
+		fprintf(stderr,"hawk-graph: can't fork\n");
+		exit(1);
+	case 0:
+		snprintf(path,sizeof(path),"%s.png",group);
+		if( chdir(OUTDIR) < 0 || (fd=open(path,O_WRONLY|O_CREAT|O_TRUNC,0644)) < 0 || dup2(fd,1) < 0 ){
+			fprintf(stderr,"hawk-graph: can't write %s/%s\n",OUTDIR,path);
+			_exit(1);
+			}
+		close(fd);
+		snprintf(path,sizeof(path),"%s.plot",group);
+		execlp("gnuplot","gnuplot",path,(char *)NULL);
+		fprintf(stderr,"hawk-graph: can't run gnuplot\n");
+		_exit(1);
+		}
+}
+
+// for clearing out OUTDIR, FTW_DEPTH hands over the contents of a directory before it
+static int
+rm_one(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+	remove(path);
+	return 0;
+}
+
+// anything in OUTDIR that isn't a png is ours and can go
+static int
+rm_notpng(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	size_t len = strlen(path);
+
+	(void)st;
+	(void)ftw;
+	if( flag == FTW_F && (len < 4 || strcmp(path+len-4,".png") != 0) )
+		remove(path);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	char *line = NULL;
+	size_t size = 0;
+	int pass = 0, running = 0;
+	long ncpu;
+	series_t **all, *s;
+	unsigned int i, j, n;
+
+	(void)argv;
+	if( argc > 1 ){
+		printf("Usage: hawk-graph <hawk.out\n");
+		printf("Plots are left in ./%s, one png per process, needs gnuplot\n",OUTDIR);
+		exit(1);
+		}
+	nftw(OUTDIR,rm_one,16,FTW_DEPTH|FTW_PHYS);	// remove any old plots
+	if( mkdir(OUTDIR,0755) < 0 ){
+		fprintf(stderr,"hawk-graph: can't make %s\n",OUTDIR);
+		exit(1);
+		}
+	Shash_size = SHASH_MIN;
+	Shash = (series_t **)xrealloc(NULL,Shash_size*sizeof(*Shash));
+	memset(Shash,0,Shash_size*sizeof(*Shash));
+
+	while( getline(&line,&size,stdin) > 0 ){
+		if( strncmp(line,"=== Pass ",9)==0 ){
+			pass = atoi(line+9);
+			continue;
+			}
+		take_line(line,pass);
+		}
+	flush_all();
+
+	// plots go by group, with their lines in value name order
+	all = (series_t **)xrealloc(NULL,(Scount+1)*sizeof(*all));
+	for(n=i=0; i<Shash_size; i++)
+		for(s=Shash[i]; s; s=s->next)
+			all[n++] = s;
+	qsort(all,n,sizeof(*all),series_cmp);
+	if( (ncpu=sysconf(_SC_NPROCESSORS_ONLN)) < 1 )
+		ncpu = 1;
+	for(i=0; i<n; i=j){
+		for(j=i+1; j<n && strcmp(all[j]->group,all[i]->group)==0; j++)
+			;
+		if( !write_plot(all+i,j-i,pass) )
+			continue;
+		if( running >= ncpu && wait(NULL) > 0 )
+			running--;
+		plot_start(all[i]->group);
+		running++;
+		}
+	while( wait(NULL) > 0 )
+		;
+	nftw(OUTDIR,rm_notpng,16,FTW_PHYS);
+	exit(0);
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "hawkstore.h"
+
+//	hawk-query --- pull series out of a hawk -S store
+
+#define	BUFSIZE		1024
+
+const store_ent_t	*Index;		// the whole index, mapped
+unsigned int	Nent;
+const char	*Data;			// the whole data file, mapped
+size_t	Datasize;
+unsigned int	*First;			// by series id, where its segments start in Segs, and end at the next id's
+unsigned int	*Segs;			// segment numbers in hawk.dat, by series and in index order
+
+static void
+usage(void)
+{
+	printf("Usage: hawk-query dir [-p pid] [-n name] [-f from] [-t to]\n");
+	printf(" with no -p or -n, list the series in the store\n");
+	printf(" -p pid only series of this process\n");
+	printf(" -n name only series of this value name\n");
+	printf(" -f from, -t to: seconds since the epoch, or if negative seconds before now\n");
+	printf("Samples are printed as: seconds pid name value\n");
+	printf("A value holds until its next sample, so the one before from is printed too\n");
+	printf("A series that ended, as its value or process went away, ends with a GONE sample\n");
+	exit(1);
+}
+
+// map a store file read only, return its size
+static const void *
+map_file(const char *dir, const char *name, size_t *size)
+{
+	char path[BUFSIZE];
+	struct stat st;
+	void *map;
+	int fd;
+
+	snprintf(path,sizeof(path),"%s/%s",dir,name);
+	if( (fd=open(path,O_RDONLY)) < 0 || fstat(fd,&st) < 0 ){
+		fprintf(stderr,"hawk-query: can't open %s\n",path);
+		exit(1);
+		}
+	*size = st.st_size;
+	map = NULL;
+	if( st.st_size && (map=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0)) == MAP_FAILED ){
+		fprintf(stderr,"hawk-query: can't map %s\n",path);
+		exit(1);
+		}
+	close(fd);
+	return map;
+}
+
+// time given on the command line, in milliseconds
+static long long int
+parse_time(const char *s)
+{
+	double t = atof(s);
+
+	if( t < 0 )
+		t += time(NULL);
+	return (long long int)(t*1000);
+}
+
+static inline void
+show_sample(const store_ent_t *se, const store_sample_t *ss)
+{
+	if( ss->val == STORE_GONE )
+		printf("%lld.%03lld %u %s GONE\n",ss->ms/1000,ss->ms%1000,se->n,se->name);
+	else
+		printf("%lld.%03lld %u %s %llx\n",ss->ms/1000,ss->ms%1000,se->n,se->name,ss->val);
+}
+
+// one walk of the index to list the segments of every series, so each series
+// is found without walking the index again
+static void
+index_segs(void)
+{
+	unsigned int i, n = 0, count, *at;
+
+	if( (First=(unsigned int *)calloc(Nent+1,sizeof(*First))) == NULL
+	 || (Segs=(unsigned int *)malloc((Nent ? Nent : 1)*sizeof(*Segs))) == NULL
+	 || (at=(unsigned int *)malloc((Nent ? Nent : 1)*sizeof(*at))) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	for(i=0; i<Nent; i++)	// how many each has
+		if( Index[i].kind == STORE_SEG && Index[i].series < Nent )
+			First[Index[i].series]++;
+	for(i=0; i<=Nent; i++){	// and so where each one starts
+		count = i < Nent ? First[i] : 0;
+		First[i] = n;
+		if( i < Nent )
+			at[i] = n;
+		n += count;
+		}
+	for(i=0; i<Nent; i++)
+		if( Index[i].kind == STORE_SEG && Index[i].series < Nent )
+			Segs[at[Index[i].series]++] = Index[i].n;
+	free(at);
+}
+
+// print the samples of series id from..to, with the one before from, up to
+// the sample ending it
+static void
+show_series(unsigned int id, long long int from, long long int to)
+{
+	const store_ent_t *se = &Index[id];
+	const store_sample_t *seg, *ss, *prev = NULL;
+	unsigned int i;
+
+	for(i=First[id]; i<First[id+1]; i++){
+		if( (Segs[i]+1ULL)*STORE_SEGSIZE > Datasize )
+			break;	// hawk.dat was cut short
+		seg = (const store_sample_t *)(Data + (size_t)Segs[i]*STORE_SEGSIZE);
+		ss = &seg[STORE_SAMPLES-1];
+		if( ss->ms && ss->ms < from && ss->val != STORE_GONE ){	// all of it is before from, no need to look inside
+			prev = ss;
+			continue;
+			}
+		for(ss=seg; ss < seg+STORE_SAMPLES && ss->ms; ss++){
+			if( ss->ms < from ){
+				if( ss->val == STORE_GONE ){	// gone before from, nothing held in from..to
+					prev = NULL;
+					break;
+					}
+				prev = ss;
+				continue;
+				}
+			if( ss->ms > to )
+				break;
+			if( prev ){
+				show_sample(se,prev);
+				prev = NULL;
+				}
+			show_sample(se,ss);
+			if( ss->val == STORE_GONE )
+				break;
+			}
+		if( ss < seg+STORE_SAMPLES )	// reached to, the end of the series, or the end of what hawk has stored
+			break;
+		}
+	if( prev )	// nothing in from..to, the value was prev all along
+		show_sample(se,prev);
+}
+
+int
+main(int argc, char **argv)
+{
+	long long int from = 0, to = 0x7fffffffffffffffLL;
+	const char *name = NULL;
+	long pid = -1;
+	unsigned int i;
+	size_t size;
+	int c;
+
+	if( argc < 2 || argv[1][0] == '-' )
+		usage();
+	optind = 2;
+	while( (c=getopt(argc,argv,"p:n:f:t:")) != -1 )
+		switch(c){
+		case 'p': pid=atol(optarg); break;
+		case 'n': name=optarg; break;
+		case 'f': from=parse_time(optarg); break;
+		case 't': to=parse_time(optarg); break;
+		default: usage();
+			}
+	if( optind < argc )
+		usage();
+
+	Index = (const store_ent_t *)map_file(argv[1],STORE_INDEX,&size);
+	Nent = size/sizeof(store_ent_t);
+	Data = (const char *)map_file(argv[1],STORE_DATA,&Datasize);
+
+	index_segs();
+
+	if( pid < 0 && name == NULL ){	// just list them, with how many segments each has
+		for(i=0; i<Nent; i++)
+			if( Index[i].kind == STORE_SERIES )
+				printf("%u %s %u\n",Index[i].n,Index[i].name,First[i+1]-First[i]);
+		exit(0);
+		}
+	for(i=0; i<Nent; i++){
+		if( Index[i].kind != STORE_SERIES )
+			continue;
+		if( (pid >= 0 && Index[i].n != pid) || (name && strcmp(Index[i].name,name) != 0) )
+			continue;
+		show_series(i,from,to);
+		}
+	exit(0);
+}
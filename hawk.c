@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <stdbool.h>
 #include <ctype.h>
 #include <string.h>
@@ -9,19 +12,66 @@
 #include <dirent.h>
 #include <time.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <pwd.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/io_uring.h>
+
+#include "hawkbin.h"
+#include "hawkstore.h"
 
 //	hawk --- watch processes for resource leaks
 
 #define	BUFSIZE		1024
-#define	TRIGGER_FILE	"/tmp/hawk_trigger"
+#define	TRIGGER_DIR	"/tmp"
+#define	TRIGGER_NAME	"hawk_trigger"
+#define	TRIGGER_FILE	TRIGGER_DIR "/" TRIGGER_NAME
 #define	UNDEF		"UNDEF"			// initial val[] of all valinfo items
 #define	MAXNAME		96			// longest name
 #define	MAXVAL		256			// longest string value
 #define	MAXPNAME	32			// longest process name
+#define	PHASH_MIN	1024			// initial pid hash buckets, power of 2
+#define	NHASH_MIN	1024			// initial name intern buckets, power of 2
+#define	VHASH_MIN	16			// initial per-proc value buckets, power of 2
+#define	SHASH_MIN	1024			// initial string value buckets, power of 2
+#define	VBLOCK_SIZE	65536			// bytes of values allocated at a time, power of 2
+#define	VBATCH		64			// values a thread takes from the current block at a time
+#define	PFREE_MAX	256			// spare proc_t kept for reuse
+#define	FD_RESERVE	64			// fds left free for things other than kept /proc files
+#define	CHUNK_PROCS	32			// processes handed to a scan thread at a time
+#define	WQUEUE_MAX	4			// passes -w queues for the writer before scanning waits
+#define	WSPARE_MAX	2			// written blocks kept for their buffers
+#define	BACKOFF_MAX	32			// most passes -a lets an unchanging process go unread
+#define	LEAK_WINDOW	32			// samples -L's slope and average mostly look at
+#define	FILTER_RECHECK	16			// passes a pid's -P -n -U -C verdict is trusted for
+#define	TOPK_WINDOW	8			// passes -K's growth average mostly looks at
+#define	EVICT_MIN	8			// passes a process is watched before -M may trim or evict it
+#define	EVICT_RECHECK	16			// passes between looks at an evicted process' VmRSS and fds
+#define	URING_BATCH	32			// processes whose files -I reads at once
+#define	URING_ENTRIES	256			// io_uring size, room for a batch of every file
 
 unsigned int	Pass	= 0;
+unsigned int	Passes	= 0;		// -c: stop after this many passes, 0 to go on for ever
+const char	*Proc_root	= "/proc";	// -R: where to look for /proc, for made up trees
 bool	Pass_printed	= false;	// has this pass caused any output?
-int	Update_interval	= 10;		// seconds between updates
+long	Update_interval	= 10000;	// milliseconds between updates
+int	Tfd		= -1;		// timerfd ticking every Update_interval, -1 if we time it ourselves
+struct timespec	Next_tick;		// when the next pass is due, without a timerfd
+struct timespec	Pass_mono;		// CLOCK_MONOTONIC at the start of this pass
+unsigned int	Pass_missed	= 0;	// ticks skipped because the last pass overran
 bool	Verbose		= false;
 bool	Timewatch	= false;	// watch accumulated time
 bool	Memwatch	= false;	// watch memory related items
@@ -30,29 +80,320 @@ bool	Filewatch	= false;	// watch file open/close related items
 bool	Kernelwatch	= false;	// watch kernel related items
 bool	Yaffswatch	= false;	// watch YAFFS related items
 bool	Diskwatch	= false;	// watch disk I/O related items
+bool	Smapswatch	= false;	// read smaps_rollup totals with -m
+bool	Adaptive	= false;	// read processes less often while they don't change
+unsigned int	Leak_run	= 0;	// -L: increases without a decrease between them before LEAK?, 0 for off
+double	Leak_growth	= 1.0;		// -g: and growing by at least this many % an hour
+bool	Quiet		= false;	// only print LEAK? lines
+unsigned int	Topk	= 0;		// -K: read only this many fastest growing processes in full, 0 for all
+bool	Uring		= false;	// -I: read /proc files a batch of processes at a time through io_uring
+size_t	Mem_budget	= 0;		// -M: bytes hawk may keep about processes, 0 for no limit
+size_t	Sbytes		= 0;		// kept for string values
 bool	Externaltrigger	= false;	// trigger new pass by watching for file?
+bool	Sigtrigger	= false;	// trigger new pass with SIGUSR1?
+int	Ifd		= -1;		// inotify watching TRIGGER_DIR, -1 to poll for the file instead
+int	Sfd		= -1;		// signalfd for SIGUSR1
+int	Nthreads	= 1;		// threads scanning /proc
+bool	Binary		= false;	// write hawkbin.h records instead of text
+bool	Bgwrite		= false;	// hand finished passes to a writer thread
+bool	Events		= false;	// follow fork/exec/exit through the proc connector
+int	Evfd		= -1;		// proc connector socket, -1 if not in use
+bool	Events_lost	= true;		// events may have been missed, rescan /proc
+int	Hawk_pid;			// our own pid, never watched
+char	*Store_dir	= NULL;		// -S: also keep integer samples in this hawkstore.h store
+bool	Store_broken	= false;	// a write to it failed, store_close() it between passes
+int	Store_ifd	= -1;		// its index, open for appending
+int	Store_dfd	= -1;		// its data file
+unsigned int	Store_nent	= 0;	// entries in the index
+unsigned int	Store_nseg	= 0;	// segments handed out from the data file
+struct extent	*Store_ext	= NULL;	// mapping segments are being handed out from
+long long int	Store_ms;		// CLOCK_REALTIME at the start of this pass, milliseconds
+pthread_mutex_t Store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// output collected in memory so scan threads can be merged back in pid order
+typedef struct outbuf {
+	char	*buf;
+	size_t	len;
+	size_t	size;
+	int	lastpid;	// pid of the last binary record, -1 if none yet
+} outbuf_t;
+static __thread outbuf_t *Out = NULL;	// where this thread's output goes
+outbuf_t	Passout = { .lastpid = -1 };	// output of the current pass, written when it ends
+
+// a finished pass waiting for the writer thread
+typedef struct wblock {
+	struct wblock	*next;
+	outbuf_t	head;		// binary block header and name records
+	outbuf_t	body;		// the pass output itself
+} wblock_t;
+wblock_t	*Wqueue = NULL;		// oldest first
+wblock_t	**Wtail = &Wqueue;
+int	Wdepth	= 0;		// blocks in Wqueue
+wblock_t	*Wspare = NULL;		// written blocks, kept for their buffers
+int	Wnspare	= 0;		// blocks in Wspare
+pthread_mutex_t Wlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t	Wcond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t	Wdone = PTHREAD_COND_INITIALIZER;	// signalled when a block has been written
+bool	Wbusy	= false;		// writer thread is writing a block
+
+// value names are interned so each string is stored once and compared by pointer
+typedef struct name {
+	struct name	*nnext;		// next in intern hash chain
+	unsigned int	hash;
+	unsigned int	id;		// order it was interned in, used by binary output
+	char		str[];
+} name_t;
+
+name_t	**Nhash = NULL;
+unsigned int	Nhash_size = 0;		// number of buckets, always a power of 2
+unsigned int	Ncount = 0;		// number of interned names
+name_t	**Nbyid = NULL;			// interned names by id
+unsigned int	Nbyid_size = 0;
+unsigned int	Nsent = 0;		// names already sent in the binary stream
+pthread_rwlock_t Nhash_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 typedef struct val{
 	struct val	*vnext;
 	struct val	*vprev;
-	char		name[MAXNAME];
-	char		val[MAXVAL];
+	struct val	*hnext;		// next in proc's value hash chain
+	name_t		*name;
+	union {
+		long long int	i;	// VAL_INT
+		struct sval	*s;	// VAL_STR, shared by all values with the same string
+		} u;
 	unsigned int	lastupdate;
-	long long int	valint;
+	unsigned char	kind;		// VAL_UNDEF, VAL_INT or VAL_STR
+	struct trend	*trend;		// -L statistics, integer values only
+	struct series	*series;	// -S series, integer values only
 } val_t;
-val_t *Vfree = NULL;
+enum { VAL_UNDEF, VAL_INT, VAL_STR };
+
+// a string value, interned so identical strings (paths, states) are kept once
+typedef struct sval {
+	struct sval	*snext;		// next in Shash chain
+	unsigned int	hash;
+	unsigned int	refs;		// values holding it
+	char		str[];		// at most MAXVAL-1 chars
+} sval_t;
+sval_t	**Shash = NULL;
+unsigned int	Shash_size = 0;		// power of 2
+unsigned int	Scount = 0;
+pthread_mutex_t Shash_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// running statistics for -L, the same size however long hawk runs
+// Sums are exponentially weighted over about LEAK_WINDOW samples and kept
+// relative to the first sample so the doubles don't lose precision
+typedef struct trend {
+	double		x0;		// time of first sample, seconds
+	long long int	y0;		// first value
+	long long int	last;		// latest value
+	double		s0, sx, sy, sxx, sxy;	// for the least squares slope
+	double		ewma;		// moving average, relative to y0
+	double		xstart;		// time and value of the run's first increase
+	long long int	ystart;
+	unsigned int	run;		// increases since the last decrease, flat samples don't count
+	bool		reported;	// LEAK? already printed for this run
+} trend_t;
+
+// a STORE_EXTENT of the -S data file, unmapped once nothing writes into it
+typedef struct extent {
+	char		*map;
+	unsigned int	users;		// series with their current segment here, +1 while it's Store_ext
+} extent_t;
+
+// where the next -S sample of a value goes
+typedef struct series {
+	unsigned int	id;
+	extent_t	*ext;		// extent holding seg
+	store_sample_t	*seg;		// current segment, NULL before the first
+	unsigned int	used;		// samples in it
+	long long int	last;		// value of the last sample
+} series_t;
+
+// values come out of VBLOCK_SIZE blocks aligned to their size, so a value's
+// block is found from its address and blocks whose values are all spare can
+// be given back once processes go away
+typedef struct vblock {
+	struct vblock	*next;
+	unsigned int	carved;		// values handed out of it so far
+	unsigned int	nfree;		// spare ones, while counting them
+} vblock_t;
+#define	VBLOCK_VALS	((VBLOCK_SIZE-sizeof(vblock_t))/sizeof(val_t))
+#define	VBLOCK_OF(v)	((vblock_t *)((unsigned long)(v) & ~(unsigned long)(VBLOCK_SIZE-1)))
+
+static __thread val_t *Vfree = NULL;	// this thread's spare values
+val_t	*Vpool = NULL;			// spares handed between threads
+vblock_t	*Vblocks = NULL;		// all blocks, the first is the one being carved
+unsigned int	Vspare = 0;		// values freed since the last val_sweep(), roughly
+pthread_mutex_t Vpool_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned int	Pspare = 0;		// length of Pfree
+
+// per process /proc files held open across passes
+enum pfile { PF_STATUS, PF_STAT, PF_STATM, PF_MAPS, PF_SMAPS, PF_COUNT };	// not PF_MAX, <sys/socket.h> has that
+const char *Pfile_name[PF_COUNT] = {
+	[PF_STATUS] = "status",
+	[PF_STAT] = "stat",
+	[PF_STATM] = "statm",
+	[PF_MAPS] = "maps",
+	[PF_SMAPS] = "smaps_rollup",
+	};
+
+// system wide /proc files held open across passes
+enum sfile { SF_SLABINFO, SF_MEMINFO, SF_VMSTAT, SF_STAT, SF_YAFFS, SF_DISKSTATS, SF_MAX };
+struct sysfile {
+	const char	*name;		// under Proc_root
+	int		fd;
+} Sysfile[SF_MAX] = {
+	[SF_SLABINFO] = { "slabinfo", -1 },
+	[SF_MEMINFO] = { "meminfo", -1 },
+	[SF_VMSTAT] = { "vmstat", -1 },
+	[SF_STAT] = { "stat", -1 },
+	[SF_YAFFS] = { "yaffs", -1 },
+	[SF_DISKSTATS] = { "diskstats", -1 },
+	};
+
+// /proc/<pid>/stat field numbers, see proc(5)
+enum {
+	STAT_FLAGS = 9,
+	STAT_UTIME = 14, STAT_STIME, STAT_CUTIME, STAT_CSTIME, STAT_PRIORITY, STAT_NICE,
+	STAT_KSTKESP = 29, STAT_KSTKEIP, STAT_SIGNAL, STAT_BLOCKED, STAT_SIGIGNORE, STAT_SIGCATCH,
+	STAT_MAX = 52
+	};
+unsigned long long int	Stat_mask = 0;	// stat fields the selected categories use
+int	Stat_last = 0;			// highest numbered of those
+
+// /proc/<pid>/statm field numbers
+enum { STATM_TRS = 4, STATM_LRS, STATM_DRS, STATM_DT, STATM_MAX = STATM_DT };
+#define	STATM_MASK	((1ULL<<STATM_TRS)|(1ULL<<STATM_LRS)|(1ULL<<STATM_DRS)|(1ULL<<STATM_DT))
+
+// /proc/<pid>/status lines worth watching
+// Only those wanted by the selected categories are put in Status_slot[]
+typedef struct statuskey {
+	const char	*key;		// as it appears in status, without the :
+	const char	*name;		// value name it is reported as
+	enum { SK_NAME, SK_STATE, SK_INT } kind;
+	bool		*watch;		// category that wants it, NULL for always
+	bool		verbose;	// only with -v
+	int		keylen;
+} statuskey_t;
+
+statuskey_t Statuskeys[] = {
+	{ "Name",	"Name",		SK_NAME,	NULL,		false },
+	{ "State",	"State",	SK_STATE,	&Procwatch,	true },
+	{ "Uid",	"Uid",		SK_INT,		&Procwatch,	false },
+	{ "PPid",	"PPid",		SK_INT,		&Procwatch,	false },
+	{ "VmSize",	"VmSize",	SK_INT,		&Memwatch,	false },
+	{ "VmPeak",	"VmPeak",	SK_INT,		&Memwatch,	false },
+	{ "VmLck",	"VmLck",	SK_INT,		&Memwatch,	false },
+	{ "VmRSS",	"VmRSS",	SK_INT,		&Memwatch,	false },
+	{ "VmHWM",	"VmHWM",	SK_INT,		&Memwatch,	true },
+	{ "VmData",	"VmData",	SK_INT,		&Memwatch,	false },
+	{ "VmStk",	"VmStk",	SK_INT,		&Memwatch,	false },
+	{ "VmExe",	"VmExe",	SK_INT,		&Memwatch,	false },
+	{ "VmLib",	"VmLib",	SK_INT,		&Memwatch,	false },
+	{ "RssAnon",	"RssAnon",	SK_INT,		&Memwatch,	true },
+	{ "RssFile",	"RssFile",	SK_INT,		&Memwatch,	true },
+	{ "VmSwap",	"VmSwap",	SK_INT,		&Memwatch,	true },
+	{ "Threads",	"Threads",	SK_INT,		&Procwatch,	false },
+	{ NULL }
+	};
+#define	STATUS_SLOTS	64		// power of 2, comfortably more than Statuskeys[]
+unsigned char	Status_slot[STATUS_SLOTS];	// 1 + index into Statuskeys[], 0 if empty
+int	Status_nkeys = 0;		// number of keys in Status_slot[]
+
+unsigned int	Fd_kept = 0;		// /proc files currently held open
+unsigned int	Fd_keepmax = 0;		// most /proc files we are willing to hold open
+static __thread char	*Rbuf = NULL;	// reusable buffer /proc files are read into
+static __thread size_t	Rbuf_size = 0;
+
+// one mapping from /proc/<pid>/maps, reported as Mmap-<start> with its end as the value
+typedef struct mmap {
+	unsigned long long int	start;
+	unsigned long long int	end;
+} mmap_t;
+static __thread mmap_t	*Mscratch = NULL;	// this pass's maps, before they replace the last pass's
+static __thread unsigned int	Mscratch_size = 0;
+
+// an open fd and the Fd<n> value holding its link target
+typedef struct fdent {
+	int		fd;
+	struct val	*v;
+} fdent_t;
+static __thread fdent_t	*Fdscratch = NULL;	// this pass's fds, before they replace the last pass's
+static __thread unsigned int	Fdscratch_size = 0;
+static __thread char	*Dentbuf = NULL;	// getdents64 buffer
 
 typedef struct proc {
 	struct proc	*pnext;
 	struct proc	*pprev;
+	struct proc	*hnext;		// next in pid hash chain
 	unsigned int	pid;		// pid of this process
 	val_t		vlist;		// list of watched values
 	unsigned int	vcount;		// how many values for this proc
+	val_t		**vhash;	// values hashed by interned name
+	unsigned int	vhash_size;	// number of buckets, always a power of 2
+	val_t		*vhint;		// value expected to be looked up next
 	unsigned int	appeared;	// first time this pid was noticed
 	unsigned int	lastupdate;	// last time this pid was updated
+	unsigned int	lastsample;	// last pass its values were read
+	unsigned int	lastchange;	// last pass one of its values changed
+	unsigned int	backoff;	// passes between reads with -a
 	bool		isclone;	// is this a clone of some other pid?
+	bool		evicted;	// dropped by -M, only its exit and evict_recheck() still see it
+	bool		trimmed;	// -M let go of its fds and maps, its fds are only counted
+	long long int	erss;		// -M: VmRSS and number of fds when evicted, -1 if not there
+	long long int	efds;
+	bool		ktop;		// -K: among the fastest growing, read in full
+	long long int	krss;		// -K: VmRSS, FdCount and Threads last pass, -1 if not there
+	long long int	kfds;
+	long long int	kthreads;
+	double		kgrowth;	// -K: moving average of their % growth a pass
+	double		kpass;		// -K: their % growth this pass, so far
+	bool		isnew;		// not yet announced
+	int		cindex;		// position in clone_check()'s walk this pass
+	int		ctried;		// cindex of the last proc compared against this one
+	int		dirfd;		// /proc/<pid>, or -1 if not open
+	int		fds[PF_COUNT];	// open /proc/<pid> files, -1 if not open
+	int		fddir;		// open /proc/<pid>/fd, or -1
+	int		uslot;		// -I: its place in this thread's batch, or -1
+	fdent_t		*fdents;	// fds seen last pass, by number
+	unsigned int	nfds;
+	unsigned int	fdents_size;
+	mmap_t		*maps;		// mappings by start address, kept apart from vlist
+	unsigned int	nmaps;
+	unsigned int	maps_size;
 }proc_t;
 
+// -I: a scanning thread's io_uring and the files it read for the current batch
+// Each process in the batch has a slot of Uring_slot bytes in buf, split by
+// Uring_size, and pre[] says which of those were read in full.
+typedef struct uring {
+	int		fd;
+	void		*sq_map;	// MAP_FAILED if not mapped
+	void		*cq_map;
+	struct io_uring_sqe	*sqes;
+	size_t		sq_size, cq_size, sqes_size;
+	unsigned int	*sq_tail, *sq_mask, *sq_array;
+	unsigned int	*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe	*cqes;
+	char		*buf;
+	char		*pre[URING_BATCH][PF_COUNT];	// NULL to read it the usual way
+	proc_t		*batch[URING_BATCH];
+	int		nbatch;
+} uring_t;
+static __thread uring_t	*Ur = NULL;	// NULL to read files one at a time
+uring_t	**Worker_ur = NULL;		// -j: the io_uring of each scan_worker() slot, kept from pass to pass
+// Room for each file, bigger ones are read again as usual.  A /proc seq_file
+// hands out about a page a read once it has more than one record, so only
+// files shown whole in one go are read this way, and maps never is.
+const unsigned int Uring_size[PF_COUNT] = {
+	[PF_STATUS] = 4096,
+	[PF_STAT] = 1024,
+	[PF_STATM] = 256,
+	[PF_SMAPS] = 4096,
+	};
+#define	URING_SLOT	(4096+1024+256+4096)
+
 proc_t *Pfree = NULL;
 proc_t Phead = {
 	.pnext = &Phead,
@@ -64,6 +405,167 @@ proc_t Phead = {
 	.isclone = false,
 	};
 
+// pid hash, sits beside the Phead list so lookups don't walk every process
+proc_t	**Phash = NULL;
+unsigned int	Phash_size = 0;		// number of buckets, always a power of 2
+unsigned int	Pcount = 0;		// number of procs in the hash
+
+// processes found this pass, in the order readdir returned them
+proc_t	**Scan = NULL;
+int	Nscan = 0;
+int	Scan_size = 0;
+
+// Scan[] cut into pieces for the scan threads, each with its own output
+typedef struct chunk {
+	proc_t		**procs;
+	int		nprocs;
+	outbuf_t	out;
+} chunk_t;
+chunk_t	*Chunks = NULL;
+int	Nchunks = 0;
+int	Chunks_size = 0;
+int	Next_chunk = 0;			// next chunk a scan thread should take
+
+// -i: hawk's own costs, shown as the values of a HAWK process with hawk's pid
+// Times are in nanoseconds here and microseconds when shown.  The collectors
+// add up over scan threads, the phases are wall clock.
+enum self {
+	SELF_STATUS, SELF_STAT, SELF_STATM, SELF_MAPS, SELF_SMAPS, SELF_FD,
+	SELF_SYSTEM, SELF_SCAN, SELF_CLONE, SELF_CLEANUP, SELF_OUTPUT, SELF_PASS,
+	SELF_TIMES,	// the rest are counts
+	SELF_OPENS = SELF_TIMES, SELF_READS, SELF_BYTES, SELF_LOOKUPS, SELF_CREATES, SELF_LINES,
+	SELF_COUNT
+	};
+const char *Self_name[SELF_COUNT] = {
+	[SELF_STATUS] = "Time-Status", [SELF_STAT] = "Time-Stat", [SELF_STATM] = "Time-Statm",
+	[SELF_MAPS] = "Time-Maps", [SELF_SMAPS] = "Time-Smaps", [SELF_FD] = "Time-Fd",
+	[SELF_SYSTEM] = "Time-System", [SELF_SCAN] = "Time-Scan", [SELF_CLONE] = "Time-Clone",
+	[SELF_CLEANUP] = "Time-Cleanup", [SELF_OUTPUT] = "Time-Output", [SELF_PASS] = "Time-Pass",
+	[SELF_OPENS] = "Opens", [SELF_READS] = "Reads", [SELF_BYTES] = "ReadBytes",
+	[SELF_LOOKUPS] = "Lookups", [SELF_CREATES] = "Creates", [SELF_LINES] = "Lines",
+	};
+bool	Selfwatch	= false;
+static __thread long long int	Self[SELF_COUNT];	// this thread's share of the pass
+long long int	Self_total[SELF_COUNT];		// the last pass, all threads added up
+
+// now, if -i wants it
+static inline long long int
+self_clock(void)
+{
+	struct timespec ts;
+
+	if( !Selfwatch )
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+// charge the time since start to one of Self[], return now for the next one
+static inline long long int
+self_time(enum self which, long long int start)
+{
+	long long int now;
+
+	if( !Selfwatch )
+		return 0;
+	now = self_clock();
+	Self[which] += now - start;
+	return now;
+}
+
+// add this thread's counts into Self_total
+static void
+self_merge(void)
+{
+	int i;
+
+	for(i=0; i<SELF_COUNT; i++)
+		if( Self[i] ){
+			__atomic_add_fetch(&Self_total[i],Self[i],__ATOMIC_RELAXED);
+			Self[i] = 0;
+			}
+}
+
+// make room for n more bytes (and a NUL) in an output buffer
+static inline void
+ob_reserve(outbuf_t *ob, size_t n)
+{
+	if( ob->len+n < ob->size )
+		return;
+	while( ob->len+n >= ob->size )
+		ob->size = ob->size ? ob->size*2 : 4*BUFSIZE;
+	ob->buf = (char *)realloc(ob->buf,ob->size);
+	if( ob->buf==NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+}
+
+static inline void
+ob_byte(outbuf_t *ob, int c)
+{
+	ob_reserve(ob,1);
+	ob->buf[ob->len++] = c;
+}
+
+static inline void
+ob_varint(outbuf_t *ob, unsigned long long int v)
+{
+	ob_reserve(ob,10);
+	ob->len += put_varint((unsigned char *)ob->buf+ob->len,v);
+}
+
+static inline void
+ob_bytes(outbuf_t *ob, const void *s, size_t n)
+{
+	ob_reserve(ob,n);
+	memcpy(ob->buf+ob->len,s,n);
+	ob->len += n;
+}
+
+// append to this thread's output buffer
+// In binary mode the text goes in a record with the given tag
+static void
+out_rec(int tag, const char *fmt, va_list ap)
+{
+	unsigned char hdr[11];
+	va_list ap2;
+	size_t at;
+	int n, h;
+
+	va_copy(ap2,ap);
+	at = Out->len + (Binary ? sizeof(hdr) : 0);	// leave room for the record header
+	n = vsnprintf(Out->size > at ? Out->buf+at : NULL,Out->size > at ? Out->size-at : 0,fmt,ap);
+	if( at+n >= Out->size ){
+		ob_reserve(Out,at-Out->len+n);
+		vsnprintf(Out->buf+at,Out->size-at,fmt,ap2);
+		}
+	va_end(ap2);
+	if( Binary ){
+		h = 0;
+		hdr[h++] = tag;
+		h += put_varint(hdr+h,n);
+		memmove(Out->buf+Out->len+h,Out->buf+at,n);
+		memcpy(Out->buf+Out->len,hdr,h);
+		n += h;
+		}
+	Out->len += n;
+}
+
+static void
+out(const char *fmt, ...) __attribute__((format(printf,1,2)));
+
+// print to this thread's output buffer, as REC_TEXT in binary mode
+static void
+out(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap,fmt);
+	out_rec(REC_TEXT,fmt,ap);
+	va_end(ap);
+}
+
 // replace all whitespace with _
 static inline void
 no_white(char *s)
@@ -73,60 +575,423 @@ no_white(char *s)
 			*s = '_';
 }
 
-static inline val_t *
-val_alloc(void)
+static inline unsigned int
+str_hash(const char *s)
 {
-	val_t *v = Vfree;
+	unsigned int h = 2166136261u;	// FNV-1a
+
+	while( *s )
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static void
+nhash_grow(void)
+{
+	unsigned int oldsize = Nhash_size;
+	name_t **old = Nhash;
+	name_t *n, *nn;
+	unsigned int i;
+
+	Nhash_size = oldsize ? oldsize*2 : NHASH_MIN;
+	Nhash = (name_t **)calloc(Nhash_size,sizeof(*Nhash));
+	if( Nhash==NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	for(i=0; i<oldsize; i++)
+		for(n=old[i]; n; n=nn){
+			nn = n->nnext;
+			n->nnext = Nhash[n->hash & (Nhash_size-1)];
+			Nhash[n->hash & (Nhash_size-1)] = n;
+			}
+	free(old);
+}
+
+// caller holds Nhash_lock
+static inline name_t *
+name_find(const char *s, unsigned int h)
+{
+	name_t *n = NULL;
+
+	if( Nhash_size )
+		for(n=Nhash[h & (Nhash_size-1)]; n; n=n->nnext)
+			if( n->hash == h && strcmp(n->str,s)==0 )
+				break;
+	return n;
+}
+
+// return the one shared copy of a value name, creating it on first use
+// Scan threads intern names concurrently
+static name_t *
+name_intern(const char *s)
+{
+	char tmp[MAXNAME];
+	unsigned int h;
+	name_t *n;
 
-	if( v == NULL ){
-		v = (val_t *)malloc(sizeof(*v));
-		if( v==NULL ){
+	if( strlen(s) >= MAXNAME ){	// same truncation as the old fixed size name[]
+		strncpy(tmp,s,MAXNAME-1);
+		tmp[MAXNAME-1] = '\0';
+		s = tmp;
+		}
+	h = str_hash(s);
+	pthread_rwlock_rdlock(&Nhash_lock);
+	n = name_find(s,h);
+	pthread_rwlock_unlock(&Nhash_lock);
+	if( n )
+		return n;
+
+	pthread_rwlock_wrlock(&Nhash_lock);
+	if( (n=name_find(s,h)) == NULL ){	// another thread may have just added it
+		if( Ncount >= Nhash_size )
+			nhash_grow();
+		n = (name_t *)malloc(sizeof(*n)+strlen(s)+1);
+		if( n==NULL ){
 			printf("Out of memory\n");
 			exit(1);
 			}
+		strcpy(n->str,s);
+		n->hash = h;
+		n->nnext = Nhash[h & (Nhash_size-1)];
+		Nhash[h & (Nhash_size-1)] = n;
+		if( Ncount >= Nbyid_size ){
+			Nbyid_size = Nbyid_size ? Nbyid_size*2 : NHASH_MIN;
+			Nbyid = (name_t **)realloc(Nbyid,Nbyid_size*sizeof(*Nbyid));
+			if( Nbyid==NULL ){
+				printf("Out of memory\n");
+				exit(1);
+				}
+			}
+		n->id = Ncount;
+		Nbyid[Ncount++] = n;
 		}
-	else
-		Vfree = v->vnext;
-	v->name[0] = '\0';
-	v->val[0] = '\0';
+	pthread_rwlock_unlock(&Nhash_lock);
+	return n;
+}
+
+static void
+shash_grow(void)
+{
+	unsigned int oldsize = Shash_size;
+	sval_t **old = Shash;
+	sval_t *sv, *svn;
+	unsigned int i;
+
+	Shash_size = oldsize ? oldsize*2 : SHASH_MIN;
+	Shash = (sval_t **)calloc(Shash_size,sizeof(*Shash));
+	if( Shash==NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	for(i=0; i<oldsize; i++)
+		for(sv=old[i]; sv; sv=svn){
+			svn = sv->snext;
+			sv->snext = Shash[sv->hash & (Shash_size-1)];
+			Shash[sv->hash & (Shash_size-1)] = sv;
+			}
+	free(old);
+}
+
+// the shared copy of string value s, cut to MAXVAL-1 chars, with a reference for the caller
+static sval_t *
+str_get(const char *s)
+{
+	size_t len = strnlen(s,MAXVAL-1), i;
+	unsigned int h = 2166136261u;	// FNV-1a, like str_hash()
+	sval_t *sv;
+
+	for(i=0; i<len; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+	pthread_mutex_lock(&Shash_lock);
+	if( Scount >= Shash_size )
+		shash_grow();
+	for(sv=Shash[h & (Shash_size-1)]; sv; sv=sv->snext)
+		if( sv->hash == h && strncmp(sv->str,s,len)==0 && sv->str[len]=='\0' )
+			break;
+	if( sv == NULL ){
+		sv = (sval_t *)malloc(sizeof(*sv)+len+1);
+		if( sv==NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		memcpy(sv->str,s,len);
+		sv->str[len] = '\0';
+		sv->hash = h;
+		sv->refs = 0;
+		sv->snext = Shash[h & (Shash_size-1)];
+		Shash[h & (Shash_size-1)] = sv;
+		Scount++;
+		Sbytes += sizeof(*sv)+len+1;
+		}
+	sv->refs++;
+	pthread_mutex_unlock(&Shash_lock);
+	return sv;
+}
+
+// drop a reference from str_get(), the last one frees it
+static void
+str_put(sval_t *sv)
+{
+	sval_t **svp;
+
+	pthread_mutex_lock(&Shash_lock);
+	if( --sv->refs == 0 ){
+		for(svp = &Shash[sv->hash & (Shash_size-1)]; *svp != sv; svp = &(*svp)->snext)
+			;
+		*svp = sv->snext;
+		Scount--;
+		Sbytes -= sizeof(*sv)+strlen(sv->str)+1;
+		free(sv);
+		}
+	pthread_mutex_unlock(&Shash_lock);
+}
+
+// set a value, newint is NULL for string values and "" makes it UNDEF
+static inline void
+val_set(val_t *v, const char *newval, const long long int *newint)
+{
+	if( v->kind == VAL_STR )
+		str_put(v->u.s);
+	if( newint ){
+		v->kind = VAL_INT;
+		v->u.i = *newint;
+		}
+	else if( *newval ){
+		v->kind = VAL_STR;
+		v->u.s = str_get(newval);
+		}
+	else {
+		v->kind = VAL_UNDEF;
+		v->u.i = 0;
+		}
+}
+
+// a value as hawk prints it, "" if undefined, buf has room for an integer
+static inline const char *
+val_str(const val_t *v, char *buf)
+{
+	if( v->kind == VAL_INT ){
+		sprintf(buf,"%llx",v->u.i);
+		return buf;
+		}
+	return v->kind == VAL_STR ? v->u.s->str : "";
+}
+
+// another VBATCH values from the current block, caller holds Vpool_lock
+static val_t *
+val_carve(void)
+{
+	vblock_t *b = Vblocks;
+	val_t *vals, *list = NULL;
+	int i;
+
+	if( b == NULL || b->carved == VBLOCK_VALS ){
+		b = (vblock_t *)aligned_alloc(VBLOCK_SIZE,VBLOCK_SIZE);
+		if( b==NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		b->next = Vblocks;
+		b->carved = 0;
+		b->nfree = 0;
+		Vblocks = b;
+		}
+	vals = (val_t *)(b+1);
+	for(i=0; i<VBATCH && b->carved < VBLOCK_VALS; i++){
+		vals[b->carved].vnext = list;
+		list = &vals[b->carved++];
+		}
+	return list;
+}
+
+static inline val_t *
+val_alloc(void)
+{
+	val_t *v = Vfree;
+
+	if( v == NULL ){	// take the shared spares, or some new ones
+		pthread_mutex_lock(&Vpool_lock);
+		if( (v=Vpool) != NULL )
+			Vpool = NULL;
+		else
+			v = val_carve();
+		pthread_mutex_unlock(&Vpool_lock);
+		}
+	Vfree = v->vnext;
+	v->name = NULL;
+	v->hnext = NULL;
+	v->kind = VAL_UNDEF;
+	v->u.i = 0;
 	v->vnext = v;
 	v->vprev = v;
 	v->lastupdate = -1;
+	v->trend = NULL;
+	v->series = NULL;
 	return v;
 }
 
+static void store_end(series_t *s);
+
+// what a value holds besides itself
+static inline void
+val_release(val_t *v)
+{
+	if( v->kind == VAL_STR )
+		str_put(v->u.s);
+	v->kind = VAL_UNDEF;
+	free(v->trend);
+	v->trend = NULL;
+	if( v->series )
+		store_end(v->series);
+	v->series = NULL;
+}
+
 // remove val from list and release it
 static inline void
 val_free(val_t *v)
 {
 	v->vnext->vprev = v->vprev;
 	v->vprev->vnext = v->vnext;
+	val_release(v);
 	v->vnext = Vfree;
 	Vfree = v;
+	Vspare++;
+}
+
+// hand this thread's spare values to the shared pool so scan threads can reuse them
+static void
+val_share(void)
+{
+	val_t *v;
+
+	if( Vfree == NULL )
+		return;
+	pthread_mutex_lock(&Vpool_lock);
+	for(v=Vfree; v->vnext; v=v->vnext)
+		;
+	v->vnext = Vpool;
+	Vpool = Vfree;
+	Vfree = NULL;
+	pthread_mutex_unlock(&Vpool_lock);
+}
+
+// give back blocks whose values are all spare once a block's worth have
+// been freed, only between passes when no scan threads are running
+static void
+val_sweep(void)
+{
+	vblock_t *b, **bp;
+	val_t *v, **vp;
+	bool freed = false;
+
+	if( Vspare < VBLOCK_VALS )
+		return;
+	Vspare = 0;
+	val_share();
+	pthread_mutex_lock(&Vpool_lock);
+	for(v=Vpool; v; v=v->vnext)
+		VBLOCK_OF(v)->nfree++;
+	for(vp = &Vpool; (v=*vp) != NULL; )	// the first block is still being carved, keep it
+		if( VBLOCK_OF(v) != Vblocks && VBLOCK_OF(v)->nfree == VBLOCK_OF(v)->carved )
+			*vp = v->vnext;
+		else
+			vp = &v->vnext;
+	for(bp = &Vblocks; (b=*bp) != NULL; )
+		if( b != Vblocks && b->nfree == b->carved ){
+			*bp = b->next;
+			free(b);
+			freed = true;
+			}
+		else {
+			b->nfree = 0;
+			bp = &b->next;
+			}
+	pthread_mutex_unlock(&Vpool_lock);
+	if( freed )
+		malloc_trim(0);	// the blocks were below the mmap threshold, hand the pages back
+}
+
+static void
+vhash_grow(proc_t *p)
+{
+	unsigned int oldsize = p->vhash_size;
+	val_t **old = p->vhash;
+	val_t *v, *vn;
+	unsigned int i;
+
+	p->vhash_size = oldsize ? oldsize*2 : VHASH_MIN;
+	p->vhash = (val_t **)calloc(p->vhash_size,sizeof(*p->vhash));
+	if( p->vhash==NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	for(i=0; i<oldsize; i++)
+		for(v=old[i]; v; v=vn){
+			vn = v->hnext;
+			v->hnext = p->vhash[v->name->hash & (p->vhash_size-1)];
+			p->vhash[v->name->hash & (p->vhash_size-1)] = v;
+			}
+	free(old);
+}
+
+static inline void
+vhash_remove(proc_t *p, val_t *v)
+{
+	val_t **vp;
+
+	for(vp = &p->vhash[v->name->hash & (p->vhash_size-1)]; *vp; vp = &(*vp)->hnext)
+		if( *vp == v ){
+			*vp = v->hnext;
+			break;
+			}
+	if( p->vhint == v )
+		p->vhint = NULL;
+}
+
+// find a value by interned name, NULL if the proc doesn't have it
+static inline val_t *
+val_find(proc_t *p, name_t *n)
+{
+	val_t *v = NULL;
+
+	if( p->vhash_size )
+		for(v=p->vhash[n->hash & (p->vhash_size-1)]; v; v=v->hnext)
+			if( v->name == n )
+				break;
+	return v;
 }
 
 // lookup value by name
 // return existing value if found, otherwise create a new val_t with 'undefined' values
+// New values go on the front of vlist, so walking vprev from the last value found
+// follows the order the /proc files list them in; try that before hashing
 static inline val_t *
 val_lookup(proc_t *p, const char *name)
 {
-	val_t *v;
+	val_t *v = p->vhint;
+	name_t *n;
 
-	if( strcmp(name,"Name")==0 )
-		return &p->vlist;
-	for(v=p->vlist.vnext; v != &p->vlist; v=v->vnext)
-		if( strncmp(name,v->name,MAXVAL-1)== 0)
-			return v;
-	// create it
-	v = val_alloc();
-	strncpy(v->name,name,MAXNAME-1);
-	v->val[0] = '\0';
-	v->valint = 0;
-	v->vnext = p->vlist.vnext;
-	v->vprev = &p->vlist;
-	v->vnext->vprev = v;
-	v->vprev->vnext = v;
-	p->vcount++;
+	Self[SELF_LOOKUPS]++;
+	if( v == NULL || strcmp(name,v->name->str) != 0 ){
+		n = name_intern(name);
+		v = n == p->vlist.name ? &p->vlist : val_find(p,n);
+		if( v == NULL ){	// create it
+			Self[SELF_CREATES]++;
+			if( p->vcount >= p->vhash_size )
+				vhash_grow(p);
+			v = val_alloc();
+			v->name = n;
+			v->vnext = p->vlist.vnext;
+			v->vprev = &p->vlist;
+			v->vnext->vprev = v;
+			v->vprev->vnext = v;
+			v->hnext = p->vhash[n->hash & (p->vhash_size-1)];
+			p->vhash[n->hash & (p->vhash_size-1)] = v;
+			p->vcount++;
+			}
+		}
+	p->vhint = v->vprev;
 	return v;
 }
 
@@ -135,6 +1000,7 @@ proc_alloc(void)
 {
 	proc_t *p = Pfree;
 	val_t *v;
+	int i;
 
 	if( p == NULL ){
 		p = (proc_t *)malloc(sizeof(*p));
@@ -143,8 +1009,10 @@ proc_alloc(void)
 			exit(1);
 			}
 		}
-	else
+	else {
 		Pfree = p->pnext;
+		Pspare--;
+		}
 
 	p->pid = -1;
 	p->pnext = p;
@@ -152,691 +1020,3082 @@ proc_alloc(void)
 	v = &p->vlist;
 	v->vnext = v;
 	v->vprev = v;
-	strcpy(v->name,"Name");
-	v->val[0] = '\0';
+	v->name = name_intern("Name");
+	v->kind = VAL_UNDEF;
+	v->u.i = 0;
+	v->trend = NULL;
+	v->series = NULL;
 	p->vcount = 0;
+	p->vhash = NULL;
+	p->vhash_size = 0;
+	p->vhint = NULL;
+	p->dirfd = -1;
+	for(i=0; i<PF_COUNT; i++)
+		p->fds[i] = -1;
+	p->fddir = -1;
+	p->uslot = -1;
+	p->fdents = NULL;
+	p->nfds = p->fdents_size = 0;
+	p->maps = NULL;
+	p->nmaps = p->maps_size = 0;
 	p->appeared = p->lastupdate = Pass;
+	p->lastsample = -1;
+	p->lastchange = Pass;
+	p->backoff = 1;
 	p->isclone = false;	// not a clone until proven otherwise
+	p->evicted = p->trimmed = false;
+	p->ktop = false;
+	p->krss = p->kfds = p->kthreads = -1;
+	p->kgrowth = p->kpass = 0;
+	p->isnew = true;
 	return p;
 }
 
-static inline void
-show_pass()
+static inline unsigned int
+pid_hash(unsigned int pid)
 {
-	time_t t;
-
-	if( !Pass_printed ){
-		time(&t);
-		printf("=== Pass %d =================== %s",Pass,ctime(&t));
-		Pass_printed=true;
-		}
+	return pid & (Phash_size-1);	// pids are handed out sequentially, low bits spread well
 }
 
-static inline char *
-proc_name(proc_t *p)
+// double the pid hash (or create it) and rehash everything
+static void
+phash_grow(void)
 {
-	return val_lookup(p,"Name")->val;
+	unsigned int oldsize = Phash_size;
+	proc_t **old = Phash;
+	proc_t *p, *pn;
+	unsigned int i;
+
+	Phash_size = oldsize ? oldsize*2 : PHASH_MIN;
+	Phash = (proc_t **)calloc(Phash_size,sizeof(*Phash));
+	if( Phash==NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	for(i=0; i<oldsize; i++)
+		for(p=old[i]; p; p=pn){
+			pn = p->hnext;
+			p->hnext = Phash[pid_hash(p->pid)];
+			Phash[pid_hash(p->pid)] = p;
+			}
+	free(old);
 }
 
 static inline void
-pid_display(proc_t *p)
+phash_insert(proc_t *p)
 {
-	show_pass();
-	printf("%d %s ",p->pid,proc_name(p));
+	if( Pcount >= Phash_size )
+		phash_grow();
+	p->hnext = Phash[pid_hash(p->pid)];
+	Phash[pid_hash(p->pid)] = p;
+	Pcount++;
 }
 
 static inline void
-proc_free(proc_t *p)
+phash_remove(proc_t *p)
 {
-	// remove from proc list
-	p->pnext->pprev = p->pprev;
-	p->pprev->pnext = p->pnext;
-
-	// report if requested
-	if(Procwatch && Verbose){
-		pid_display(p);
-		printf("================================================================Exited\n");
-		}
+	proc_t **pp;
 
-	// save for later
-	p->pnext = Pfree;
-	Pfree = p;
+	for(pp = &Phash[pid_hash(p->pid)]; *pp; pp = &(*pp)->hnext)
+		if( *pp == p ){
+			*pp = p->hnext;
+			Pcount--;
+			break;
+			}
 }
 
+// put the pass header before the first output of a pass
+// Scan threads leave it to be added when their output is merged,
+// binary blocks carry the pass in their own header
 static inline void
-val_update_common(proc_t *p, val_t *v, char *newval)
+show_pass()
 {
-	unsigned int long long oldint,newint;
-	char *endo, *endn;
-	char *oldval = v->val;
+	time_t t;
 
-	if( *oldval == '\0' ){
-		oldval = UNDEF;
-		if( strcmp(v->name,"Name")==0 )	// name going from UNDEF to something, update it now so pid_display is right
-			strncpy(v->val,newval,sizeof(v->val)-1);
+	if( !Pass_printed && Out == &Passout && !Binary ){
+		time(&t);
+		out("=== Pass %d =================== %.24s mono %lld.%03ld",Pass,ctime(&t),
+			(long long int)Pass_mono.tv_sec,Pass_mono.tv_nsec/1000000);
+		if( Pass_missed )
+			out(" missed %u",Pass_missed);
+		out("\n");
+		Pass_printed=true;
 		}
-	if( *newval == '\0' )
-		newval = UNDEF;
+}
 
-	pid_display(p);
-	printf("%s %s %s",v->name,oldval,newval);
-	strncpy(v->val,newval,sizeof(v->val)-1);
+static void
+out_line(const char *fmt, ...) __attribute__((format(printf,1,2)));
+
+// print a whole line that belongs under the pass header
+static void
+out_line(const char *fmt, ...)
+{
+	va_list ap;
+
+	Self[SELF_LINES]++;
+	show_pass();
+	va_start(ap,fmt);
+	out_rec(REC_LINE,fmt,ap);
+	va_end(ap);
 }
 
-static inline void
-val_update_str(proc_t *p, const char *name, char *newval)
+// write all of iov to stdout, coping with short writes
+// Errors are ignored, as printf would have
+static void
+write_all(struct iovec *iov, int n)
 {
-	val_t *v = val_lookup(p,name);
+	ssize_t w;
 
-	v->lastupdate = Pass;
-	no_white(newval);
-	if( v->val[0] == '\0' ){	// previously undefined
-		if(Verbose || (p->lastupdate == p->appeared)){
-			val_update_common(p,v,newval);
-			printf("\n");
+	while( n > 0 ){
+		if( (w=writev(STDOUT_FILENO,iov,n)) < 0 ){
+			if( errno == EINTR )
+				continue;
+			return;
 			}
-		}
-	else {	// see if it has changed
-		if( strncmp(newval,v->val,MAXVAL-1) != 0 ){
-			val_update_common(p,v,newval);
-			printf("\n");
+		while( n > 0 && (size_t)w >= iov->iov_len ){
+			w -= iov->iov_len;
+			iov++;
+			n--;
+			}
+		if( n > 0 ){
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
 			}
 		}
 }
 
 static inline void
-val_update_int(proc_t *p, const char *name, const long long int val)
+wblock_write(wblock_t *wb)
 {
-	val_t *v = val_lookup(p,name);
-	char	newval[MAXVAL];
+	struct iovec iov[2] = {
+		{ wb->head.buf, wb->head.len },
+		{ wb->body.buf, wb->body.len },
+		};
 
-	v->lastupdate = Pass;
-	sprintf(newval,"%llx",val);
-	if( v->val[0] == '\0' ){	// previously undefined
+	write_all(iov,2);
+}
+
+// writer thread: write finished passes in order as they are queued
+static void *
+writer_thread(void *arg)
+{
+	wblock_t *wb;
+
+	for(;;){
+		pthread_mutex_lock(&Wlock);
+		while( Wqueue == NULL )
+			pthread_cond_wait(&Wcond,&Wlock);
+		wb = Wqueue;
+		if( (Wqueue=wb->next) == NULL )
+			Wtail = &Wqueue;
+		Wdepth--;
+		Wbusy = true;
+		pthread_mutex_unlock(&Wlock);
+
+		wblock_write(wb);
+
+		pthread_mutex_lock(&Wlock);
+		if( Wnspare < WSPARE_MAX ){
+			wb->next = Wspare;
+			Wspare = wb;
+			Wnspare++;
+			wb = NULL;
+			}
+		Wbusy = false;
+		pthread_cond_broadcast(&Wdone);
+		pthread_mutex_unlock(&Wlock);
+		if( wb ){	// enough spares, a burst of big passes shouldn't stay around
+			free(wb->head.buf);
+			free(wb->body.buf);
+			free(wb);
+			}
+		}
+	return arg;
+}
+
+// wait until the writer thread has written everything queued
+static void
+writer_drain(void)
+{
+	pthread_mutex_lock(&Wlock);
+	while( Wqueue != NULL || Wbusy )
+		pthread_cond_wait(&Wdone,&Wlock);
+	pthread_mutex_unlock(&Wlock);
+}
+
+// write a finished pass with one writev, or queue it for the writer thread
+// The buffers are swapped with spare ones rather than copied, and come back empty.
+// With WQUEUE_MAX passes queued already, wait for the writer to catch up.
+static void
+pass_write(outbuf_t *head, outbuf_t *body)
+{
+	wblock_t wb, *q;
+	outbuf_t t;
+
+	if( !Bgwrite ){
+		wb.head = *head;
+		wb.body = *body;
+		wblock_write(&wb);
+		head->len = body->len = 0;
+		body->lastpid = -1;
+		return;
+		}
+
+	pthread_mutex_lock(&Wlock);
+	if( (q=Wspare) != NULL ){
+		Wspare = q->next;
+		Wnspare--;
+		}
+	pthread_mutex_unlock(&Wlock);
+	if( q == NULL && (q=(wblock_t *)calloc(1,sizeof(*q))) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	t = q->head; q->head = *head; *head = t;
+	t = q->body; q->body = *body; *body = t;
+	head->len = body->len = 0;
+	body->lastpid = -1;
+	q->next = NULL;
+
+	pthread_mutex_lock(&Wlock);
+	while( Wdepth >= WQUEUE_MAX )
+		pthread_cond_wait(&Wdone,&Wlock);
+	*Wtail = q;
+	Wtail = &q->next;
+	Wdepth++;
+	pthread_cond_signal(&Wcond);
+	pthread_mutex_unlock(&Wlock);
+}
+
+static inline const char *
+proc_name(proc_t *p)
+{
+	return p->vlist.kind == VAL_STR ? p->vlist.u.s->str : "";	// Name is always the list head
+}
+
+static inline void
+pid_display(proc_t *p)
+{
+	Self[SELF_LINES]++;
+	show_pass();
+	out("%d %s ",p->pid,proc_name(p));
+}
+
+// binary records apply to the last pid given, only say it again when it changes
+static inline void
+bin_pid(proc_t *p)
+{
+	Self[SELF_LINES]++;	// every record starts here
+	if( Out->lastpid != (int)p->pid ){
+		ob_byte(Out,REC_PID);
+		ob_varint(Out,p->pid);
+		Out->lastpid = p->pid;
+		}
+}
+
+// binary form of a value change, newint is NULL for string values
+static inline void
+bin_update(proc_t *p, val_t *v, bool wasundef, const char *newval, const long long int *newint)
+{
+	bin_pid(p);
+	ob_byte(Out,newint ? REC_INT : REC_STR);
+	ob_byte(Out,wasundef ? REC_UNDEF : 0);
+	ob_varint(Out,v->name->id);
+	if( newint )
+		ob_varint(Out,zigzag(wasundef ? *newint : (long long int)((unsigned long long int)*newint - (v->kind == VAL_INT ? v->u.i : 0))));
+	else {
+		ob_varint(Out,strlen(newval));
+		ob_bytes(Out,newval,strlen(newval));
+		}
+}
+
+// write the binary records collected this pass as one block
+// names interned since the last block are sent first
+static void
+bin_flush(void)
+{
+	static outbuf_t names, head;
+	name_t *n;
+
+	if( Passout.len == 0 )
+		return;
+	names.len = 0;
+	ob_varint(&names,Pass);
+	ob_varint(&names,time(NULL));
+	ob_varint(&names,Pass_mono.tv_sec*1000ULL + Pass_mono.tv_nsec/1000000);
+	ob_varint(&names,Pass_missed);
+	for(; Nsent < Ncount; Nsent++){
+		n = Nbyid[Nsent];
+		ob_byte(&names,REC_NAME);
+		ob_varint(&names,n->id);
+		ob_varint(&names,strlen(n->str));
+		ob_bytes(&names,n->str,strlen(n->str));
+		}
+	head.len = 0;
+	ob_varint(&head,names.len+Passout.len);
+	ob_bytes(&head,names.buf,names.len);
+	pass_write(&head,&Passout);
+}
+
+// end of pass, send out whatever it printed
+static void
+pass_flush(void)
+{
+	static outbuf_t none;
+
+	if( Binary )
+		bin_flush();
+	else if( Passout.len )
+		pass_write(&none,&Passout);
+}
+
+static inline void
+proc_free(proc_t *p)
+{
+	// remove from proc list and pid hash
+	p->pnext->pprev = p->pprev;
+	p->pprev->pnext = p->pnext;
+	phash_remove(p);
+
+	// report if requested
+	if( Binary ){	// always sent so the decoder can forget the pid
+		bin_pid(p);
+		ob_byte(Out,REC_EXIT);
+		ob_byte(Out,Procwatch && Verbose && !Quiet);
+		}
+	else if(Procwatch && Verbose && !Quiet){
+		pid_display(p);
+		out("================================================================Exited\n");
+		}
+
+	val_release(&p->vlist);
+
+	// save for later, unless there are plenty saved already
+	if( Pspare >= PFREE_MAX ){
+		free(p);
+		return;
+		}
+	p->pnext = Pfree;
+	Pfree = p;
+	Pspare++;
+}
+
+// report a changed value, newint is NULL for string values
+// integer changes after the first also show the difference
+static inline void
+val_update_common(proc_t *p, val_t *v, char *newval, const long long int *newint)
+{
+	bool wasundef = v->kind == VAL_UNDEF;
+	bool setnow = wasundef && v == &p->vlist;
+	long long int oldint = v->kind == VAL_INT ? v->u.i : 0;
+	char oldbuf[32];
+	const char *oldval = wasundef ? UNDEF : val_str(v,oldbuf);
+
+	p->lastchange = Pass;
+	if( setnow )	// name going from UNDEF to something, update it now so pid_display is right
+		val_set(v,newval,newint);
+	if( Binary && !Quiet )
+		bin_update(p,v,wasundef,newval,newint);
+	if( *newval == '\0' )
+		newval = UNDEF;
+
+	if( !Binary && !Quiet ){
+		pid_display(p);
+		if( newint && !wasundef ){
+			if( *newint > oldint )
+				out("%s %s %s +%llx\n",v->name->str,oldval,newval,*newint-oldint);
+			else
+				out("%s %s %s -%llx\n",v->name->str,oldval,newval,oldint-*newint);
+			}
+		else
+			out("%s %s %s\n",v->name->str,oldval,newval);
+		}
+	if( !setnow )	// after printing, oldval may be the string this drops
+		val_set(v,newval,newint);
+}
+
+static inline void
+val_set_str(proc_t *p, val_t *v, char *newval)
+{
+	char buf[32];
+
+	v->lastupdate = Pass;
+	no_white(newval);
+
+	if( v->kind == VAL_UNDEF ){	// previously undefined
+		if(Verbose || (p->lastupdate == p->appeared))
+			val_update_common(p,v,newval,NULL);
+		}
+	else {	// see if it has changed
+		if( strncmp(newval,val_str(v,buf),MAXVAL-1) != 0 )
+			val_update_common(p,v,newval,NULL);
+		}
+}
+
+static inline void
+val_update_str(proc_t *p, const char *name, char *newval)
+{
+	val_set_str(p,val_lookup(p,name),newval);
+}
+
+// add a sample to a value's trend and say LEAK? once it has gone up Leak_run
+// times without going down, by at least Leak_growth % an hour
+// The slope used is the lesser of the least squares one and the rate since
+// the run's first increase, which leaves that first step out: a single step
+// up (a process settling in at startup) followed by flat samples never counts
+// as a leak, and doesn't make a slow one after it look faster.
+static void
+leak_sample(proc_t *p, val_t *v, long long int val)
+{
+	trend_t *t = v->trend;
+	const double decay = 1.0 - 1.0/LEAK_WINDOW;
+	double x, y, d, slope;
+
+	if( t == NULL ){
+		if( (t=v->trend=(trend_t *)calloc(1,sizeof(*t))) == NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		t->x0 = Pass_mono.tv_sec + Pass_mono.tv_nsec/1e9;
+		t->y0 = t->last = val;
+		}
+	x = Pass_mono.tv_sec + Pass_mono.tv_nsec/1e9 - t->x0;
+	y = (double)(val - t->y0);
+	t->s0 = t->s0*decay + 1;
+	t->sx = t->sx*decay + x;
+	t->sy = t->sy*decay + y;
+	t->sxx = t->sxx*decay + x*x;
+	t->sxy = t->sxy*decay + x*y;
+	t->ewma += (y - t->ewma) * 2/(LEAK_WINDOW+1);
+	if( val < t->last ){
+		t->run = 0;
+		t->reported = false;
+		}
+	else if( val > t->last ){
+		if( t->run++ == 0 ){
+			t->xstart = x;
+			t->ystart = val;
+			}
+		}
+	t->last = val;
+
+	if( t->reported || t->run < Leak_run || x <= t->xstart )
+		return;
+	d = t->s0*t->sxx - t->sx*t->sx;
+	if( d <= 0 || (slope=(t->s0*t->sxy - t->sx*t->sy)/d) <= 0 )
+		return;
+	if( (double)(val - t->ystart)/(x - t->xstart) < slope )
+		slope = (double)(val - t->ystart)/(x - t->xstart);
+	if( t->ewma + t->y0 > 0 && slope*3600*100/(t->ewma + t->y0) < Leak_growth )
+		return;
+	t->reported = true;
+	out_line("%d %s LEAK? %s %llx %+.3g/s run %u avg %llx\n",p->pid,proc_name(p),v->name->str,
+		val,slope,t->run,(long long int)(t->ewma + t->y0));
+}
+
+// the -S store can't be opened at startup
+static void
+store_fail(const char *what)
+{
+	printf("%s: %s, stopping\n",what,strerror(errno));
+	exit(1);
+}
+
+// give up on -S after a write error (a full disk, most likely) rather than
+// keep failing every sample, but go on watching: samples are no longer kept
+// and store_close() closes the store between passes
+// Called with Store_lock held.
+static void
+store_stop(const char *what)
+{
+	if( !Store_broken )
+		out("%s/%s: %s, no longer keeping samples\n",Store_dir,what,strerror(errno));
+	__atomic_store_n(&Store_broken,true,__ATOMIC_RELAXED);
+}
+
+// append an entry to the index, with Store_lock held, and return its number
+static unsigned int
+store_append(store_ent_t *e)
+{
+	if( write(Store_ifd,e,sizeof(*e)) != sizeof(*e) ){
+		store_stop(STORE_INDEX);
+		return Store_nent;
+		}
+	return Store_nent++;
+}
+
+static void
+store_open(void)
+{
+	char path[BUFSIZE];
+	struct stat st;
+
+	if( mkdir(Store_dir,0755) < 0 && errno != EEXIST )
+		store_fail(Store_dir);
+	snprintf(path,sizeof(path),"%s/%s",Store_dir,STORE_INDEX);
+	if( (Store_ifd=open(path,O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC,0644)) < 0 || fstat(Store_ifd,&st) < 0 )
+		store_fail(path);
+	Store_nent = st.st_size/sizeof(store_ent_t);
+	if( st.st_size % sizeof(store_ent_t) && ftruncate(Store_ifd,(off_t)Store_nent*sizeof(store_ent_t)) < 0 )
+		store_fail(path);	// cut off an entry half written when hawk last stopped
+	snprintf(path,sizeof(path),"%s/%s",Store_dir,STORE_DATA);
+	if( (Store_dfd=open(path,O_RDWR|O_CREAT|O_CLOEXEC,0644)) < 0 || fstat(Store_dfd,&st) < 0 )
+		store_fail(path);
+	// carry on at the next extent, whatever is left of the last one stays unused
+	Store_nseg = (st.st_size + STORE_EXTENT-1)/STORE_EXTENT * (STORE_EXTENT/STORE_SEGSIZE);
+}
+
+// drop a series' hold on its extent, unmapping the extent if it was the last
+static void
+store_release(series_t *s)
+{
+	extent_t *x = s->ext;
+
+	if( x == NULL )
+		return;
+	pthread_mutex_lock(&Store_lock);
+	if( --x->users == 0 ){
+		munmap(x->map,STORE_EXTENT);
+		free(x);
+		}
+	pthread_mutex_unlock(&Store_lock);
+	s->ext = NULL;
+	s->seg = NULL;
+}
+
+// move a series on to a new segment
+static void
+store_segment(series_t *s)
+{
+	store_ent_t e;
+	extent_t *x;
+	off_t off;
+
+	store_release(s);
+	pthread_mutex_lock(&Store_lock);
+	if( Store_ext == NULL || Store_nseg % (STORE_EXTENT/STORE_SEGSIZE) == 0 ){
+		if( Store_ext && --Store_ext->users == 0 ){
+			munmap(Store_ext->map,STORE_EXTENT);
+			free(Store_ext);
+			}
+		off = (off_t)Store_nseg*STORE_SEGSIZE;
+		Store_ext = NULL;
+		if( (x=(extent_t *)malloc(sizeof(*x))) == NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		// allocate it, not just grow the file, so a full disk is an error here
+		// and not a SIGBUS when a sample is written into the mapping
+		if( (errno=posix_fallocate(Store_dfd,off,STORE_EXTENT)) != 0
+		 || (x->map=(char *)mmap(NULL,STORE_EXTENT,PROT_READ|PROT_WRITE,MAP_SHARED,Store_dfd,off)) == MAP_FAILED ){
+			store_stop(STORE_DATA);
+			free(x);
+			pthread_mutex_unlock(&Store_lock);
+			return;	// s->seg stays NULL
+			}
+		x->users = 1;
+		Store_ext = x;
+		}
+	memset(&e,0,sizeof(e));
+	e.kind = STORE_SEG;
+	e.series = s->id;
+	e.n = Store_nseg;
+	store_append(&e);
+	if( Store_broken ){	// the index doesn't say whose the segment is
+		pthread_mutex_unlock(&Store_lock);
+		return;
+		}
+	s->ext = Store_ext;
+	s->ext->users++;
+	s->seg = (store_sample_t *)(Store_ext->map + (Store_nseg % (STORE_EXTENT/STORE_SEGSIZE))*STORE_SEGSIZE);
+	s->used = 0;
+	Store_nseg++;
+	pthread_mutex_unlock(&Store_lock);
+}
+
+// add a sample to the end of a series
+static void
+store_put(series_t *s, long long int val)
+{
+	if( __atomic_load_n(&Store_broken,__ATOMIC_RELAXED) )
+		return;
+	if( s->seg == NULL || s->used == STORE_SAMPLES )
+		store_segment(s);
+	if( s->seg == NULL )
+		return;	// it broke just now
+	s->seg[s->used].val = val;
+	s->seg[s->used].ms = Store_ms;	// last, a reader takes ms != 0 as the sample being there
+	s->used++;
+	s->last = val;
+}
+
+// the value of a series has gone, mark its end and let go of it
+static void
+store_end(series_t *s)
+{
+	store_put(s,STORE_GONE);
+	store_release(s);
+	free(s);
+}
+
+// after store_stop(), let go of the store and everything in it, with no scan
+// threads running
+static void
+store_close(void)
+{
+	proc_t *p;
+	val_t *v;
+
+	for(p=Phead.pnext; p != &Phead; p=p->pnext)
+		for(v=p->vlist.vnext; v != &p->vlist; v=v->vnext)
+			if( v->series ){
+				store_release(v->series);
+				free(v->series);
+				v->series = NULL;
+				}
+	if( Store_ext && --Store_ext->users == 0 ){
+		munmap(Store_ext->map,STORE_EXTENT);
+		free(Store_ext);
+		}
+	Store_ext = NULL;
+	close(Store_ifd);
+	close(Store_dfd);
+	Store_ifd = Store_dfd = -1;
+	Store_dir = NULL;
+	Store_broken = false;
+}
+
+// keep a sample of an integer value in the -S store
+static void
+store_sample(proc_t *p, val_t *v, long long int val)
+{
+	series_t *s = v->series;
+	store_ent_t e;
+
+	if( s == NULL ){
+		if( (s=v->series=(series_t *)calloc(1,sizeof(*s))) == NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		memset(&e,0,sizeof(e));
+		e.kind = STORE_SERIES;
+		e.n = p->pid;
+		strncpy(e.name,v->name->str,sizeof(e.name)-1);
+		pthread_mutex_lock(&Store_lock);
+		s->id = store_append(&e);
+		pthread_mutex_unlock(&Store_lock);
+		}
+	store_put(s,val);
+}
+
+static inline void
+val_update_int(proc_t *p, const char *name, const long long int val)
+{
+	val_t *v = val_lookup(p,name);
+	char	newval[32];
+
+	if( Leak_run )
+		leak_sample(p,v,val);
+	v->lastupdate = Pass;
+	if( v->kind == VAL_UNDEF ){	// previously undefined
 		if(Verbose || (p->lastupdate == p->appeared)){
-			val_update_common(p,v,newval);
-			printf("\n");
+			sprintf(newval,"%llx",val);
+			val_update_common(p,v,newval,&val);
 			}
-		v->valint = val;
+		// a value that stays UNDEF comes here every pass, store it only when it changes
+		if( Store_dir && (v->series == NULL || v->series->last != val) )
+			store_sample(p,v,val);
 		return;
 		}
 
-	if( v->valint == val )
+	if( v->kind == VAL_INT && v->u.i == val )
 		return;	// did not change
 
-	val_update_common(p,v,newval);
-	if( val > v->valint )
-		printf(" +%llx\n",val-v->valint);
+	sprintf(newval,"%llx",val);
+	val_update_common(p,v,newval,&val);
+	if( Store_dir )
+		store_sample(p,v,val);
+}
+
+// report a mapping that appeared (old NULL), went away (new NULL) or changed size
+// in the same form as a value named Mmap-<start>
+static void
+map_report(proc_t *p, unsigned long long int start, const unsigned long long int *oldend, const unsigned long long int *newend)
+{
+	p->lastchange = Pass;
+	if( Quiet )
+		return;
+	if( Binary ){
+		bin_pid(p);
+		ob_byte(Out,REC_MAP);
+		ob_byte(Out,(oldend ? 0 : REC_UNDEF) | (newend ? 0 : REC_GONE));
+		ob_varint(Out,start);
+		if( oldend )
+			ob_varint(Out,*oldend);
+		if( newend )
+			ob_varint(Out,*newend);
+		return;
+		}
+	pid_display(p);
+	if( oldend == NULL )
+		out("Mmap-%016llx %s %llx\n",start,UNDEF,*newend);
+	else if( newend == NULL )
+		out("Mmap-%016llx %llx %s\n",start,*oldend,UNDEF);
+	else if( *newend > *oldend )
+		out("Mmap-%016llx %llx %llx +%llx\n",start,*oldend,*newend,*newend-*oldend);
 	else
-		printf(" -%llx\n",v->valint-val);
-	v->valint = val;
+		out("Mmap-%016llx %llx %llx -%llx\n",start,*oldend,*newend,*oldend-*newend);
 }
 
 static inline proc_t *
 lookup_proc(const int pid)
 {
-	proc_t *p;
+	proc_t *p = NULL;
 
-	for(p=Phead.pnext; p != &Phead; p=p->pnext)
-		if( p->pid == pid )
-			break;
-	if( p == &Phead ){
+	if( Phash_size )
+		for(p=Phash[pid_hash(pid)]; p; p=p->hnext)
+			if( p->pid == pid )
+				break;
+	if( p == NULL ){
 		p = proc_alloc();
 		p->pid = pid;
 		p->pnext = &Phead;
 		p->pprev = Phead.pprev;
 		p->pnext->pprev = p;
 		p->pprev->pnext = p;
-		if(Procwatch && Verbose){
-			pid_display(p);
-			printf("=================================================New\n");
-			}
+		phash_insert(p);
 		}
 	p->lastupdate = Pass;
 	return p;
 }
 
-void
-update_pid_status(proc_t *p, const char *path)
+// report a process the first time it is seen
+static inline void
+proc_announce(proc_t *p)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	char *s;
-	int namelen;
-
-	if(fp==NULL)return;
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		if( strncmp("Name:",buf,5)==0 ){
-			s = &buf[6];
-			namelen = strlen(s);	// name length, including newline
-			if( namelen > 0 )
-				namelen--;
-			s[namelen]='\0';
-			no_white(s);
-			val_update_str(p,"Name",s);
-			}
-		else if( Procwatch && Verbose && strncmp("State:",buf,6)==0 ){
-			s = &buf[7];
-			s[1] = '\0';
-			val_update_str(p,"State",s);
-			}
-		else if( Procwatch && strncmp("Uid:",buf,4)==0 )
-			val_update_int(p,"Uid",strtol(buf+4,NULL,10));
-		else if( Procwatch && strncmp("PPid:",buf,5)==0 )
-			val_update_int(p,"PPid",strtol(buf+5,NULL,10));
-		else if( Memwatch && strncmp("VmSize:",buf,7)==0 )
-			val_update_int(p,"VmSize",strtol(buf+7,NULL,10));
-		else if( Memwatch && strncmp("VmPeak:",buf,7)==0 )
-			val_update_int(p,"VmPeak",strtol(buf+7,NULL,10));
-		else if( Memwatch && strncmp("VmLck:",buf,6)==0 )
-			val_update_int(p,"VmLck",strtol(buf+6,NULL,10));
-		else if( Memwatch && strncmp("VmRSS:",buf,6)==0 )
-			val_update_int(p,"VmRSS",strtol(buf+6,NULL,10));
-		else if( Memwatch && Verbose && strncmp("VmHWM:",buf,6)==0 )
-			val_update_int(p,"VmHWM",strtol(buf+6,NULL,10));
-		else if( Memwatch && strncmp("VmData:",buf,7)==0 )
-			val_update_int(p,"VmData",strtol(buf+7,NULL,10));
-		else if( Memwatch && strncmp("VmStk:",buf,6)==0 )
-			val_update_int(p,"VmStk",strtol(buf+6,NULL,10));
-		else if( Memwatch && strncmp("VmExe:",buf,6)==0 )
-			val_update_int(p,"VmExe",strtol(buf+6,NULL,10));
-		else if( Memwatch && strncmp("VmLib:",buf,6)==0 )
-			val_update_int(p,"VmLib",strtol(buf+6,NULL,10));
-		else if( Procwatch && strncmp("Threads:",buf,8)==0 )
-			val_update_int(p,"Threads",strtol(buf+8,NULL,10));
-		}
-	fclose(fp);
+	if( !p->isnew )
+		return;
+	p->isnew = false;
+	if( Binary ){	// always sent so the decoder starts the pid afresh
+		bin_pid(p);
+		ob_byte(Out,REC_NEW);
+		ob_byte(Out,Procwatch && Verbose && !Quiet);
+		}
+	else if(Procwatch && Verbose && !Quiet){
+		pid_display(p);
+		out("=================================================New\n");
+		}
 }
 
-void
-update_pid_stat(proc_t *p, const char *path)
+// read all of an open /proc file into Rbuf, NUL terminated
+// return NULL if the read fails
+static char *
+read_file(int fd)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	int nscan;
-	char task_comm[BUFSIZE];
-	char state;
-	int task_pid, ppid, task_pgrp, task_session;
-	int tty_nr, tty_pgrp;
-	unsigned long long int task_flags;
-	unsigned long long int min_flt, cmin_flt, maj_flt, cmaj_flt;
-	unsigned long long int tms_utime, tms_stime, tms_cutime, tms_cstime;
-	unsigned long long int priority, nice, junk, it_real_value, start_time;
-	unsigned long long int vsize, rss, rss_rlimit;
-	unsigned long long int start_code, end_code, start_stack, esp, eip;
-	unsigned long long int sigpending, sigblocked, sigignored, sigcaught;
-	unsigned long long int wchan, task_nswap, task_cnswap;
-	int exit_signal, processor;
-	char *scanfmt = 
-		"%d %s %c %d %d %d "
-		"%d %d %llu "
-		"%llu %llu %llu %llu "
-		"%llu %llu %lld %lld "
-		"%lld %lld %lld %lld %llu "
-		"%llu %lld %llu "
-		"%llu %llu %llu %llu %llu "
-		"%llu %llu %llu %llu "
-		"%llu %llu %llu %d %d\n"
-		;
-	char *s;
-
-	if(fp==NULL)return;
-	buf[0] = '\0';
-	fgets(buf,sizeof(buf),fp);
-	fclose(fp);
-	if(buf[0]=='\0')
-		return;
+	size_t len = 0;
+	ssize_t n;
 
-	// replace any whitespace betweeen () with _
-	for( s = index(buf,'('); s && *s && *s != ')'; s++)
-		if( isspace(*s) )
-			*s = '_';
+	for(;;){
+		if( Rbuf_size - len < BUFSIZE ){
+			Rbuf_size = Rbuf_size ? Rbuf_size*2 : 4*BUFSIZE;
+			Rbuf = (char *)realloc(Rbuf,Rbuf_size);
+			if( Rbuf==NULL ){
+				printf("Out of memory\n");
+				exit(1);
+				}
+			}
+		n = pread(fd,Rbuf+len,Rbuf_size-len-1,len);
+		Self[SELF_READS]++;
+		if( n < 0 )
+			return NULL;
+		if( n == 0 )
+			break;
+		len += n;
+		Self[SELF_BYTES] += n;
+		}
+	Rbuf[len] = '\0';
+	return Rbuf;
+}
 
-	nscan = sscanf(buf,scanfmt,
-		&task_pid, task_comm, &state, &ppid, &task_pgrp, &task_session,
-		&tty_nr, &tty_pgrp, &task_flags,
-		&min_flt, &cmin_flt, &maj_flt, &cmaj_flt,
-		&tms_utime, &tms_stime, &tms_cutime, &tms_cstime,
-		&priority, &nice, &junk, &it_real_value, &start_time,
-		&vsize, &rss, &rss_rlimit,
-		&start_code, &end_code, &start_stack, &esp, &eip,
-		&sigpending, &sigblocked, &sigignored, &sigcaught,
-		&wchan, &task_nswap, &task_cnswap, &exit_signal, &processor);
+// hold on to an fd for later passes if there are fds to spare, otherwise close it
+static inline int
+keep_fd(int fd)
+{
+	if( fd < 0 )
+		return -1;
+	if( __atomic_add_fetch(&Fd_kept,1,__ATOMIC_RELAXED) > Fd_keepmax ){
+		__atomic_sub_fetch(&Fd_kept,1,__ATOMIC_RELAXED);
+		close(fd);
+		return -1;
+		}
+	return fd;
+}
 
-	if( nscan != 39 ){
-		printf("pid_stat nscan:%d\nbuf:%s\nscanfmt:%s\n",nscan,buf,scanfmt);
-		return;
+static inline void
+drop_fd(int *fdp)
+{
+	if( *fdp >= 0 ){
+		close(*fdp);
+		__atomic_sub_fetch(&Fd_kept,1,__ATOMIC_RELAXED);
+		*fdp = -1;
 		}
-	if(Timewatch){
-		val_update_int(p,"Utime",tms_utime);
-		val_update_int(p,"Stime",tms_stime);
-		val_update_int(p,"CUtime",tms_cutime);
-		val_update_int(p,"CStime",tms_cstime);
-	}
-	if(Procwatch && Verbose){
-		val_update_int(p,"Sp",esp);
-		val_update_int(p,"Pc",eip);
+}
+
+// close everything held open for this process
+static void
+pid_close(proc_t *p)
+{
+	int i;
+
+	for(i=0; i<PF_COUNT; i++)
+		drop_fd(&p->fds[i]);
+	drop_fd(&p->fddir);
+	drop_fd(&p->dirfd);
+}
+
+// open /proc/<pid> so its files can be opened relative to it
+// return -1 if the process has gone
+static int
+pid_opendir(proc_t *p)
+{
+	char pdir[BUFSIZE];
+	int fd;
+
+	if( p->dirfd >= 0 )
+		return p->dirfd;
+	snprintf(pdir,sizeof(pdir),"%s/%d",Proc_root,p->pid);
+	fd = open(pdir,O_RDONLY|O_DIRECTORY);
+	Self[SELF_OPENS]++;
+	if( fd < 0 )
+		return -1;
+	p->dirfd = keep_fd(fd);
+	if( p->dirfd < 0 ){	// out of fds to keep, try again without holding it
+		Self[SELF_OPENS]++;
+		return open(pdir,O_RDONLY|O_DIRECTORY);
 		}
-	if(Procwatch){
-		val_update_int(p,"Priority",priority);
-		val_update_int(p,"TaskFlags",task_flags);
-		val_update_int(p,"Nice",nice);
-		val_update_int(p,"Sigpending",sigpending);
-		val_update_int(p,"Sigblocked",sigblocked);
-		val_update_int(p,"Sigignored",sigignored);
-		val_update_int(p,"Sigcaught",sigcaught);
+	return fd;
+}
+
+static inline void
+pid_closedir(proc_t *p, int dfd)
+{
+	if( dfd != p->dirfd )
+		close(dfd);
+}
+
+// read one of the /proc/<pid> files, opening it the first time and re-reading it with pread after that
+// A file held open from an earlier pass can go stale if the pid exits and is reused,
+// so on failure everything is reopened once before giving up
+static char *
+pid_read(proc_t *p, enum pfile which)
+{
+	char *buf;
+	int fd, dfd;
+	bool wasopen = p->fds[which] >= 0;
+
+	if( p->uslot >= 0 && (buf=Ur->pre[p->uslot][which]) != NULL ){	// -I read it already
+		Ur->pre[p->uslot][which] = NULL;	// the parsers write on it, it's good for once
+		return buf;
+		}
+	if( wasopen ){
+		if( (buf=read_file(p->fds[which])) != NULL )
+			return buf;
+		pid_close(p);
+		}
+	if( (dfd=pid_opendir(p)) < 0 )
+		return NULL;
+	fd = openat(dfd,Pfile_name[which],O_RDONLY);
+	Self[SELF_OPENS]++;
+	pid_closedir(p,dfd);
+	if( fd < 0 )
+		return NULL;
+	buf = read_file(fd);
+	p->fds[which] = keep_fd(fd);
+	return buf;
+}
+
+// read one of the system wide /proc files, keeping it open for later passes
+static char *
+sys_read(enum sfile which)
+{
+	struct sysfile *sf = &Sysfile[which];
+	char path[BUFSIZE];
+	char *buf;
+	int fd;
+
+	if( sf->fd >= 0 )
+		return read_file(sf->fd);
+	snprintf(path,sizeof(path),"%s/%s",Proc_root,sf->name);
+	fd = open(path,O_RDONLY);
+	Self[SELF_OPENS]++;
+	if( fd < 0 )
+		return NULL;
+	buf = read_file(fd);
+	sf->fd = keep_fd(fd);
+	return buf;
+}
+
+// return the next line of a buffer with its newline removed, or NULL at the end
+static inline char *
+next_line(char **pos)
+{
+	char *s = *pos;
+	char *nl;
+
+	if( *s == '\0' )
+		return NULL;
+	nl = strchr(s,'\n');
+	if( nl ){
+		*nl = '\0';
+		*pos = nl+1;
+		}
+	else
+		*pos = s+strlen(s);
+	return s;
+}
+
+static inline unsigned int
+key_hash(const char *s, int len)
+{
+	unsigned int h = 2166136261u;	// FNV-1a
+
+	while( len-- )
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+// build the lookup table of status keys the selected categories want
+static void
+status_setup(void)
+{
+	statuskey_t *k;
+	unsigned int h;
+
+	for(k=Statuskeys; k->key; k++){
+		if( (k->watch && !*k->watch) || (k->verbose && !Verbose) )
+			continue;
+		k->keylen = strlen(k->key);
+		for(h=key_hash(k->key,k->keylen); Status_slot[h & (STATUS_SLOTS-1)]; h++)
+			;
+		Status_slot[h & (STATUS_SLOTS-1)] = k - Statuskeys + 1;
+		Status_nkeys++;
+		}
+}
+
+// find a wanted status key, or NULL if this line is not interesting
+static inline statuskey_t *
+status_key(const char *key, int len)
+{
+	unsigned int h;
+	statuskey_t *k;
+
+	for(h=key_hash(key,len); Status_slot[h & (STATUS_SLOTS-1)]; h++){
+		k = &Statuskeys[Status_slot[h & (STATUS_SLOTS-1)]-1];
+		if( k->keylen == len && memcmp(k->key,key,len)==0 )
+			return k;
+		}
+	return NULL;
+}
+
+// % growth of a -K counter, nothing for the first sample or one that isn't there
+static inline double
+topk_growth(long long int old, long long int now)
+{
+	if( old <= 0 || now < 0 )
+		return 0;
+	return 100.0*(now-old)/old;
+}
+
+// -K: take VmRSS and Threads from a status file about to be parsed
+static inline void
+topk_status(proc_t *p, const char *buf)
+{
+	long long int rss = -1, threads = -1;
+	const char *s;
+
+	if( (s=strstr(buf,"\nVmRSS:")) != NULL )
+		rss = strtoll(s+7,NULL,10);
+	if( (s=strstr(buf,"\nThreads:")) != NULL )
+		threads = strtoll(s+9,NULL,10);
+	p->kpass += topk_growth(p->krss,rss) + topk_growth(p->kthreads,threads);
+	p->krss = rss;
+	p->kthreads = threads;
+}
+
+// -K: and the number of fds, -1 if they couldn't be listed
+static inline void
+topk_fds(proc_t *p, long long int fds)
+{
+	p->kpass += topk_growth(p->kfds,fds);
+	p->kfds = fds;
+}
+
+void
+update_pid_status(proc_t *p)
+{
+	char *pos = pid_read(p,PF_STATUS);
+	char *buf;
+	char *s;
+	statuskey_t *k;
+	int found = 0;
+
+	if(pos==NULL)return;
+	if( Topk )	// one read of status does for both
+		topk_status(p,pos);
+	while( found < Status_nkeys && (buf=next_line(&pos)) != NULL ){	// stop once every wanted key is seen
+		if( (s=strchr(buf,':')) == NULL || (k=status_key(buf,s-buf)) == NULL )
+			continue;
+		found++;
+		s++;
+		switch(k->kind){
+		case SK_NAME:
+			if( *s )
+				s++;	// skip tab
+			no_white(s);
+			val_update_str(p,k->name,s);
+			break;
+		case SK_STATE:
+			if( *s )
+				s++;	// skip tab
+			if( *s )
+				s[1] = '\0';	// just the state letter
+			val_update_str(p,k->name,s);
+			break;
+		case SK_INT:
+			val_update_int(p,k->name,strtol(s,NULL,10));
+			break;
+			}
+		}
+}
+
+// parse a decimal number, possibly negative, leaving *sp just past it
+static inline long long int
+parse_dec(char **sp)
+{
+	const unsigned char *s = (const unsigned char *)*sp;
+	unsigned long long int v = 0;
+	unsigned int d;
+	bool neg = false;
+
+	if( *s == '-' ){
+		neg = true;
+		s++;
+		}
+	while( (d=s[0]-'0') < 10 ){	// four digits per trip, most fields are short
+		v = v*10 + d;
+		if( (d=s[1]-'0') >= 10 ){ s += 1; break; }
+		v = v*10 + d;
+		if( (d=s[2]-'0') >= 10 ){ s += 2; break; }
+		v = v*10 + d;
+		if( (d=s[3]-'0') >= 10 ){ s += 3; break; }
+		v = v*10 + d;
+		s += 4;
+		}
+	*sp = (char *)s;
+	return neg ? -(long long int)v : (long long int)v;
+}
+
+// walk space separated fields numbered from f up to last, converting only those in mask into vals[]
+// return the number of the last field seen, less than last if the line was short
+static int
+parse_fields(char *s, int f, int last, unsigned long long int mask, long long int *vals)
+{
+	for(;; f++){
+		if( mask & (1ULL<<f) )
+			vals[f] = parse_dec(&s);
+		else
+			while( (unsigned char)*s > ' ' )
+				s++;
+		if( f == last || *s != ' ' )
+			return f;
+		s++;
+		}
+}
+
+void
+update_pid_stat(proc_t *p)
+{
+	char *buf = pid_read(p,PF_STAT);
+	char *s;
+	long long int f[STAT_MAX+1];
+	int nfield;
+
+	if(buf==NULL || buf[0]=='\0')
+		return;
+
+	// comm can hold anything, including spaces and parens, so fields restart after the last )
+	s = strrchr(buf,')');
+	nfield = 2;
+	if( s && s[1] == ' ' )
+		nfield = parse_fields(s+2,3,Stat_last,Stat_mask,f);
+	if( nfield != Stat_last ){
+		out("pid_stat fields:%d\nbuf:%s\n",nfield,buf);
+		return;
+		}
+	if(Timewatch){
+		val_update_int(p,"Utime",f[STAT_UTIME]);
+		val_update_int(p,"Stime",f[STAT_STIME]);
+		val_update_int(p,"CUtime",f[STAT_CUTIME]);
+		val_update_int(p,"CStime",f[STAT_CSTIME]);
+	}
+	if(Procwatch && Verbose){
+		val_update_int(p,"Sp",f[STAT_KSTKESP]);
+		val_update_int(p,"Pc",f[STAT_KSTKEIP]);
+		}
+	if(Procwatch){
+		val_update_int(p,"Priority",f[STAT_PRIORITY]);
+		val_update_int(p,"TaskFlags",f[STAT_FLAGS]);
+		val_update_int(p,"Nice",f[STAT_NICE]);
+		val_update_int(p,"Sigpending",f[STAT_SIGNAL]);
+		val_update_int(p,"Sigblocked",f[STAT_BLOCKED]);
+		val_update_int(p,"Sigignored",f[STAT_SIGIGNORE]);
+		val_update_int(p,"Sigcaught",f[STAT_SIGCATCH]);
+		}
+}
+
+void
+update_pid_statm(proc_t *p)
+{
+	char *buf = pid_read(p,PF_STATM);
+	long long int f[STATM_MAX+1];
+	int nfield;
+
+	if(buf==NULL || buf[0]=='\0')
+		return;
+
+	nfield = parse_fields(buf,1,STATM_MAX,STATM_MASK,f);
+	if( nfield != STATM_MAX ){
+		out("pid_statm scan? %d\n",nfield);
+		return;
+		}
+	val_update_int(p,"TextRSS",f[STATM_TRS]);
+	val_update_int(p,"LibRSS",f[STATM_LRS]);
+	val_update_int(p,"DataRSS",f[STATM_DRS]);
+	val_update_int(p,"Dirty",f[STATM_DT]);
+}
+
+void
+update_pid_maps(proc_t *p)
+{
+	char *pos = pid_read(p,PF_MAPS);
+	char *buf, *e;
+	mmap_t *m, *old = p->maps, *oend = p->maps + p->nmaps;
+	unsigned int n = 0;
+
+	// collect this pass's mappings, maps lists them by address
+	while( pos && (buf=next_line(&pos)) != NULL ){
+		if( n >= Mscratch_size ){
+			Mscratch_size = Mscratch_size ? Mscratch_size*2 : 256;
+			Mscratch = (mmap_t *)realloc(Mscratch,Mscratch_size*sizeof(*Mscratch));
+			if( Mscratch==NULL ){
+				printf("Out of memory\n");
+				exit(1);
+				}
+			}
+		m = &Mscratch[n];
+		m->start = strtoull(buf,&e,16);
+		if( *e != '-' )
+			continue;
+		m->end = strtoull(e+1,&e,16);
+		n++;
+		}
+
+	// merge with the last pass, reporting mappings that came, went or changed size
+	for(m=Mscratch; m < Mscratch+n || old < oend; ){
+		if( old == oend || (m < Mscratch+n && m->start < old->start) ){
+			map_report(p,m->start,NULL,&m->end);
+			m++;
+			}
+		else if( m == Mscratch+n || old->start < m->start ){
+			map_report(p,old->start,&old->end,NULL);
+			old++;
+			}
+		else {
+			if( m->end != old->end )
+				map_report(p,m->start,&old->end,&m->end);
+			m++;
+			old++;
+			}
+		}
+
+	if( n > p->maps_size ){
+		p->maps_size = n;
+		free(p->maps);
+		p->maps = (mmap_t *)malloc(n*sizeof(*p->maps));
+		if( p->maps==NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		}
+	if( n )
+		memcpy(p->maps,Mscratch,n*sizeof(*p->maps));
+	p->nmaps = n;
+}
+
+// Rss/Pss/Swap totals over all mappings, much cheaper than adding up smaps
+void
+update_pid_smaps(proc_t *p)
+{
+	static const char *keys[] = { "Rss", "Pss", "Swap", "SwapPss", NULL };
+	char *pos = pid_read(p,PF_SMAPS);
+	char *buf, *colon;
+	int i;
+
+	if(pos==NULL)return;
+	while( (buf=next_line(&pos)) != NULL ){
+		if( (colon=strchr(buf,':')) == NULL )
+			continue;
+		*colon++ = '\0';
+		for(i=0; keys[i]; i++)
+			if( strcmp(buf,keys[i])==0 ){
+				while( *colon == ' ' || *colon == '\t' )
+					colon++;
+				val_update_int(p,keys[i],parse_dec(&colon));
+				break;
+				}
+		}
+}
+
+static int
+fdent_cmp(const void *a, const void *b)
+{
+	return ((const fdent_t *)a)->fd - ((const fdent_t *)b)->fd;
+}
+
+// list the fd numbers in /proc/<pid>/fd into Fdscratch, sorted
+// return how many, or -1 if the directory can't be read
+// *dirp is left open on the directory, the caller closes it if it isn't p->fddir
+static int
+fd_list(proc_t *p, int *dirp)
+{
+	struct dirent64_hdr {	// struct linux_dirent64 without the name
+		unsigned long long int	d_ino;
+		long long int		d_off;
+		unsigned short		d_reclen;
+		unsigned char		d_type;
+		char			d_name[];
+	} *d;
+	int dfd, fd = p->fddir, n = 0;
+	long len, off;
+	bool sorted = true;
+	char *s;
+
+	if( fd < 0 ){
+		if( (dfd=pid_opendir(p)) < 0 )
+			return -1;
+		fd = p->fddir = keep_fd(openat(dfd,"fd",O_RDONLY|O_DIRECTORY));
+		Self[SELF_OPENS]++;
+		if( fd < 0 ){	// out of fds to keep, open it just for now
+			fd = openat(dfd,"fd",O_RDONLY|O_DIRECTORY);
+			Self[SELF_OPENS]++;
+			}
+		pid_closedir(p,dfd);
+		if( fd < 0 )
+			return -1;
+		}
+	else
+		lseek(fd,0,SEEK_SET);	// rescan the same directory
+	*dirp = fd;
+
+	if( Dentbuf == NULL && (Dentbuf=(char *)malloc(8*BUFSIZE)) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	while( Self[SELF_READS]++, (len=syscall(SYS_getdents64,fd,Dentbuf,8*BUFSIZE)) > 0 )
+		for(off=0, Self[SELF_BYTES] += len; off < len; off += d->d_reclen){
+			d = (struct dirent64_hdr *)(Dentbuf+off);
+			if( !isdigit((unsigned char)d->d_name[0]) )
+				continue;	// . and ..
+			if( (unsigned int)n >= Fdscratch_size ){
+				Fdscratch_size = Fdscratch_size ? Fdscratch_size*2 : 256;
+				Fdscratch = (fdent_t *)realloc(Fdscratch,Fdscratch_size*sizeof(*Fdscratch));
+				if( Fdscratch==NULL ){
+					printf("Out of memory\n");
+					exit(1);
+					}
+				}
+			s = d->d_name;
+			Fdscratch[n].fd = parse_dec(&s);
+			Fdscratch[n].v = NULL;
+			if( n > 0 && Fdscratch[n].fd < Fdscratch[n-1].fd )
+				sorted = false;
+			n++;
+			}
+	if( len < 0 )
+		return -1;
+	if( !sorted )	// the kernel lists them in order, but don't rely on it
+		qsort(Fdscratch,n,sizeof(*Fdscratch),fdent_cmp);
+	return n;
+}
+
+// read one fd's link into its Fd<n> value, return false if it has gone
+static bool
+fd_readlink(proc_t *p, int dir, fdent_t *f)
+{
+	char	link[BUFSIZE];
+	char	name[BUFSIZE];
+	int	linklen;
+
+	sprintf(name,"%d",f->fd);
+	linklen = readlinkat(dir,name,link,sizeof(link)-1);
+	Self[SELF_READS]++;
+	if( linklen <= 0 )
+		return false;
+	Self[SELF_BYTES] += linklen;
+	link[linklen] = '\0';
+	if( f->v == NULL ){
+		sprintf(name,"Fd%d",f->fd);
+		f->v = val_lookup(p,name);
+		}
+	val_set_str(p,f->v,link);
+	return true;
+}
+
+// Only an fd number not seen last pass has its Fd<n> value looked up, the
+// others go straight to the value kept in fdents.  Every link is still read,
+// as an fd closed and opened again on something else under the same number
+// looks no different in the directory (procfs gives it the same d_ino), and
+// the link is as cheap a check as fdinfo would be.
+void
+update_pid_fd(proc_t *p)
+{
+	fdent_t	*f, *old = p->fdents, *oend = p->fdents + p->nfds;
+	int	i, n, dir = -1, kept = 0;
+
+	if( (n=fd_list(p,&dir)) < 0 ){
+		if( dir >= 0 && dir != p->fddir )
+			close(dir);
+		drop_fd(&p->fddir);	// may be stale, open it afresh next pass
+		p->nfds = 0;	// cleanup() frees the Fd<n> values this pass left alone
+		if( Topk )
+			topk_fds(p,-1);
+		return;
+		}
+
+	for(i=0; i<n; i++){
+		f = &Fdscratch[i];
+		while( old < oend && old->fd < f->fd )
+			old++;
+		if( old < oend && old->fd == f->fd )
+			f->v = old->v;
+		if( fd_readlink(p,dir,f) )
+			Fdscratch[kept++] = *f;
+		}
+	if( dir != p->fddir )
+		close(dir);
+
+	if( (unsigned int)kept > p->fdents_size ){
+		p->fdents_size = kept;
+		free(p->fdents);
+		p->fdents = (fdent_t *)malloc(kept*sizeof(*p->fdents));
+		if( p->fdents==NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		}
+	if( kept )
+		memcpy(p->fdents,Fdscratch,kept*sizeof(*p->fdents));
+	p->nfds = kept;
+	val_update_int(p,"FdCount",kept);
+	if( Topk )
+		topk_fds(p,kept);
+}
+
+// -M: a trimmed process only has its fds counted
+void
+update_pid_fdcount(proc_t *p)
+{
+	int n, dir = -1;
+
+	n = fd_list(p,&dir);
+	if( dir >= 0 && dir != p->fddir )
+		close(dir);
+	if( n < 0 )
+		drop_fd(&p->fddir);	// may be stale, open it afresh next pass
+	else
+		val_update_int(p,"FdCount",n);
+	if( Topk )
+		topk_fds(p,n);
+}
+
+void
+val_cleanup(proc_t *p, val_t *v)
+{
+	val_update_str(p,v->name->str,"");
+	vhash_remove(p,v);
+	val_free(v);
+	p->vcount--;
+}
+
+// let go of everything kept about a process but the proc_t and its name
+void
+proc_drop(proc_t *p)
+{
+	val_t	*v;
+
+	while( (v=p->vlist.vnext) != &p->vlist )	// reclaim all valinfo structures
+		val_free(v);
+	p->vcount = 0;
+	pid_close(p);
+	free(p->vhash);
+	p->vhash = NULL;
+	p->vhash_size = 0;
+	p->vhint = NULL;
+	free(p->maps);
+	p->maps = NULL;
+	p->nmaps = p->maps_size = 0;
+	free(p->fdents);
+	p->fdents = NULL;
+	p->nfds = p->fdents_size = 0;
+}
+
+void
+proc_cleanup(proc_t *p)
+{
+	proc_drop(p);
+	proc_free(p);
+}
+
+// scan cache for anything that has disappeared
+// this can be either values stored, or whole processes
+void
+cleanup(void)
+{
+	proc_t	*p,*p2;
+	val_t	*v, *v2;
+
+	for(p=Phead.pnext; p != &Phead; p=p->pnext)
+		if( p->lastupdate != Pass ){	// not seen this pass
+			p2 = p->pprev;	// resume scan at previous
+			proc_cleanup(p);
+			p = p2;
+			}
+		else if( !p->isclone && p->lastsample == Pass ){	// if read this pass and not a clone, check if any values have disappeared
+			for(v=p->vlist.vnext; v != &p->vlist; v=v->vnext)
+				if( v->lastupdate != Pass ){
+					v2 = v->vprev;	// resume scan at previous
+					val_cleanup(p,v);
+					v = v2;
+					}
+			}
+}
+
+// what -M counts for each value
+static inline size_t
+proc_perval(void)
+{
+	return sizeof(val_t) + (Leak_run ? sizeof(trend_t) : 0) + (Store_dir ? sizeof(series_t) : 0);
+}
+
+// what hawk keeps for a process, as -M counts it
+static inline size_t
+proc_bytes(proc_t *p)
+{
+	return sizeof(*p) + p->vcount*proc_perval() + p->vhash_size*sizeof(*p->vhash)
+		+ p->maps_size*sizeof(*p->maps) + p->fdents_size*sizeof(*p->fdents);
+}
+
+// and how much of that proc_trim() would let go of
+static inline size_t
+proc_detail_bytes(proc_t *p)
+{
+	return p->nfds*proc_perval() + p->maps_size*sizeof(*p->maps) + p->fdents_size*sizeof(*p->fdents);
+}
+
+// a process -M could let go of
+typedef struct victim {
+	proc_t	*p;
+	size_t	bytes;
+} victim_t;
+
+// the longest unchanged first, and of those the biggest
+static int
+victim_cmp(const void *a, const void *b)
+{
+	const victim_t *v1 = (const victim_t *)a, *v2 = (const victim_t *)b;
+
+	if( v1->p->lastchange != v2->p->lastchange )
+		return v1->p->lastchange < v2->p->lastchange ? -1 : 1;
+	return v1->bytes < v2->bytes ? 1 : v1->bytes > v2->bytes ? -1 : 0;
+}
+
+// -M: let go of a process' Fd<n> values and mappings, which can run to
+// thousands, and from then on only count its fds
+static void
+proc_trim(proc_t *p)
+{
+	val_t *v, *vn;
+
+	for(v=p->vlist.vnext; v != &p->vlist; v=vn){
+		vn = v->vnext;
+		if( strncmp(v->name->str,"Fd",2)==0 && isdigit((unsigned char)v->name->str[2]) ){
+			vhash_remove(p,v);	// quietly, the fd hasn't gone
+			val_free(v);
+			p->vcount--;
+			}
+		}
+	free(p->fdents);
+	p->fdents = NULL;
+	p->nfds = p->fdents_size = 0;
+	free(p->maps);
+	p->maps = NULL;
+	p->nmaps = p->maps_size = 0;
+	p->trimmed = true;
+}
+
+// -M: the counters an evicted process is still watched by, -1 if not there
+// Nothing is kept open for it.
+static void
+evict_counters(proc_t *p, long long int *rss, long long int *fds)
+{
+	char *buf = pid_read(p,PF_STATUS);
+	char *s;
+	int dir = -1;
+
+	*rss = *fds = -1;
+	if( buf && (s=strstr(buf,"\nVmRSS:")) != NULL )
+		*rss = strtoll(s+7,NULL,10);
+	if( Filewatch ){
+		*fds = fd_list(p,&dir);
+		if( dir >= 0 && dir != p->fddir )
+			close(dir);
+		}
+	pid_close(p);
+}
+
+// -M: every EVICT_RECHECK passes, look at an evicted process' VmRSS and fds,
+// and once either has moved since it was evicted, watch it in full again
+static void
+evict_recheck(proc_t *p)
+{
+	long long int rss, fds;
+
+	if( (Pass + p->pid) % EVICT_RECHECK != 0 )
+		return;	// spread over the passes
+	evict_counters(p,&rss,&fds);
+	if( rss == p->erss && fds == p->efds )
+		return;
+	out_line("%d %s RETURNED VmRSS %lld kB, %lld fds\n",p->pid,proc_name(p),rss,fds);
+	p->evicted = false;
+	p->isclone = false;	// whatever it was a clone of, it has moved on
+	p->appeared = p->lastchange = Pass;	// its values are shown afresh, as for a new process
+	p->lastsample = -1;
+	p->backoff = 1;
+}
+
+// -M: while what hawk keeps is over budget, first let go of the fds and maps
+// of the processes that have gone longest without changing, then of those
+// processes altogether.  Each is said so.  An evicted process only has its
+// exit reported, and its VmRSS and fds looked at now and then, so it comes
+// back if it starts to grow.  A process is watched EVICT_MIN passes before it
+// can go, so there is a history of changes to go by.
+// Interned names aren't counted, they are never freed so evicting can't
+// bring them down.
+void
+budget_check(void)
+{
+	static victim_t *victim;
+	static unsigned int victim_size;
+	unsigned int n, i, round;
+	size_t total = Sbytes + Pspare*sizeof(proc_t), before;
+	proc_t *p;
+
+	if( Mem_budget == 0 )
+		return;
+	for(p=Phead.pnext; p != &Phead; p=p->pnext)
+		total += proc_bytes(p);
+
+	for(round=0; round<2 && total > Mem_budget; round++){	// trim, then evict
+		n = 0;
+		for(p=Phead.pnext; p != &Phead; p=p->pnext){
+			if( p->evicted || p->pid == 0 || p->pid == (unsigned int)Hawk_pid || Pass - p->appeared < EVICT_MIN )
+				continue;	// the kernel and hawk itself always stay, new ones stay a while
+			if( round == 0 && (p->trimmed || proc_detail_bytes(p) == 0) )
+				continue;
+			if( n >= victim_size ){
+				victim_size = victim_size ? victim_size*2 : 256;
+				victim = (victim_t *)realloc(victim,victim_size*sizeof(*victim));
+				if( victim==NULL ){
+					printf("Out of memory\n");
+					exit(1);
+					}
+				}
+			victim[n].p = p;
+			victim[n++].bytes = round == 0 ? proc_detail_bytes(p) : proc_bytes(p);
+			}
+		qsort(victim,n,sizeof(*victim),victim_cmp);
+		for(i=0; i<n && total > Mem_budget; i++){
+			p = victim[i].p;
+			before = proc_bytes(p);
+			if( round == 0 ){
+				out_line("%d %s TRIMMED %zu bytes of fds and maps, unchanged for %u passes\n",p->pid,proc_name(p),victim[i].bytes,Pass-p->lastchange);
+				proc_trim(p);
+				}
+			else {
+				out_line("%d %s EVICTED %zu bytes, unchanged for %u passes\n",p->pid,proc_name(p),victim[i].bytes,Pass-p->lastchange);
+				evict_counters(p,&p->erss,&p->efds);
+				proc_drop(p);
+				p->evicted = true;
+				p->trimmed = false;
+				}
+			total -= before - proc_bytes(p);
+			}
+		}
+}
+
+// signature of one band of a proc's values, see clone_check()
+typedef struct csig {
+	struct csig	*next;
+	unsigned long long int	key;
+	proc_t		*p;
+} csig_t;
+csig_t	*Csig = NULL;			// band signatures of procs that can still be cloned
+unsigned int	Ncsig = 0;
+unsigned int	Csig_size = 0;
+csig_t	**Csig_hash = NULL;
+unsigned int	Csig_hash_size = 0;		// power of 2
+
+// a clone found this pass, printed once they are all found
+typedef struct cmatch {
+	proc_t	*orig;
+	proc_t	*clone;
+	int	percent;
+} cmatch_t;
+
+static inline unsigned long long int
+mix64(unsigned long long int h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// interned strings are equal when their pointers are
+static inline bool
+val_same(const val_t *v1, const val_t *v2)
+{
+	if( v1->kind != v2->kind )
+		return false;
+	if( v1->kind == VAL_INT )
+		return v1->u.i == v2->u.i;
+	return v1->kind == VAL_UNDEF || v1->u.s == v2->u.s;
+}
+
+static inline unsigned int
+val_hash(const val_t *v)
+{
+	if( v->kind == VAL_INT )
+		return mix64(v->u.i);
+	return v->kind == VAL_STR ? v->u.s->hash : 0;
+}
+
+// values compared by clone_check() that don't have to match
+static inline bool
+clone_ignored(name_t *n)
+{
+	static name_t *ppid, *taskflags;
+
+	if( ppid == NULL ){
+		ppid = name_intern("PPid");
+		taskflags = name_intern("TaskFlags");
+		}
+	return n == ppid || n == taskflags;
+}
+
+// values and mappings clone_check() compares
+static inline unsigned int
+clone_nvals(proc_t *p)
+{
+	return p->vcount + p->nmaps;
+}
+
+// percentage of orig's values and mappings clone has exactly the same
+static int
+clone_percent(proc_t *orig, proc_t *clone)
+{
+	val_t	*v, *vc;
+	mmap_t	*m1 = orig->maps, *m2 = clone->maps;
+	mmap_t	*m1end = m1 + orig->nmaps, *m2end = m2 + clone->nmaps;
+	int	matchval = 0;
+
+	for(v=orig->vlist.vnext; v != &orig->vlist; v=v->vnext)
+		if( clone_ignored(v->name) )
+			matchval++;	// don't insist on a match for these
+		else if( (vc=val_find(clone,v->name)) != NULL && val_same(v,vc) )
+			matchval++;
+	while( m1 < m1end && m2 < m2end )	// both sorted by start
+		if( m1->start < m2->start )
+			m1++;
+		else if( m2->start < m1->start )
+			m2++;
+		else {
+			matchval += m1++->end == m2++->end;
+			}
+	return clone_nvals(clone) ? (matchval*100)/clone_nvals(clone) : 0;
+}
+
+static int
+cmatch_cmp(const void *a, const void *b)
+{
+	const cmatch_t *m1 = (const cmatch_t *)a, *m2 = (const cmatch_t *)b;
+
+	if( m1->orig->cindex != m2->orig->cindex )
+		return m1->orig->cindex - m2->orig->cindex;
+	return m1->clone->cindex - m2->clone->cindex;
+}
+
+// scan proc list looking for clone threads
+// if a clone is found, it is marked as such and future scans of it are skipped
+//
+// A proc is a clone of an earlier one with the same name and value count
+// when more than 95% of the values, mappings included, match, which allows
+// m = 4% of them to differ.  Each proc's values are split by name into 2m+3
+// bands and each band hashed; m differing values, and the names they push
+// out of place, spoil at most 2m bands (2 more for PPid/TaskFlags, which
+// need not be there), so a real clone shares at least one band signature
+// with its original.
+// Only procs sharing a signature are compared in full.
+void
+clone_check(void)
+{
+	static unsigned long long int *sig;
+	static int sig_size;
+	static cmatch_t *match;
+	static int match_size;
+	proc_t	*p, *q, *orig;
+	val_t	*v;
+	csig_t	*cs;
+	unsigned long long int	base;
+	int	nband, b, i, n, pct, origpct, nmatch = 0;
+
+	n = 0;
+	Ncsig = 0;
+	for(p=Phead.pnext; p != &Phead; p=p->pnext){
+		p->ctried = -1;
+		if( !p->isclone && !p->evicted ){
+			p->cindex = n++;
+			Ncsig += 2*(clone_nvals(p)*4/100)+3;
+			}
+		}
+	if( Ncsig > Csig_size ){
+		Csig_size = Ncsig;
+		free(Csig);
+		Csig = (csig_t *)malloc(Csig_size*sizeof(*Csig));
+		if( Csig==NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		}
+	if( Ncsig*2 > Csig_hash_size ){
+		while( Ncsig*2 > Csig_hash_size )
+			Csig_hash_size = Csig_hash_size ? Csig_hash_size*2 : 1024;
+		free(Csig_hash);
+		Csig_hash = (csig_t **)malloc(Csig_hash_size*sizeof(*Csig_hash));
+		if( Csig_hash==NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		}
+	memset(Csig_hash,0,Csig_hash_size*sizeof(*Csig_hash));
+	Ncsig = 0;
+
+	for(p=Phead.pnext; p != &Phead; p=p->pnext){
+		if( p->isclone || p->evicted )
+			continue;	// already known clone, or nothing left to compare
+		nband = 2*(clone_nvals(p)*4/100)+3;
+		if( nband > sig_size ){
+			sig_size = nband;
+			sig = (unsigned long long int *)realloc(sig,sig_size*sizeof(*sig));
+			if( sig==NULL ){
+				printf("Out of memory\n");
+				exit(1);
+				}
+			}
+		memset(sig,0,nband*sizeof(*sig));
+		for(v=p->vlist.vnext; v != &p->vlist; v=v->vnext)
+			if( !clone_ignored(v->name) )
+				sig[v->name->hash % nband] += mix64(((unsigned long long int)v->name->hash << 32) | val_hash(v));
+		for(i=0; i<(int)p->nmaps; i++)
+			sig[mix64(p->maps[i].start) % nband] += mix64(p->maps[i].start ^ mix64(p->maps[i].end));
+		base = mix64(mix64(((unsigned long long int)str_hash(proc_name(p)) << 32) | p->vcount) + p->nmaps);
+
+		// the first earlier proc that matches is the original
+		orig = NULL;
+		origpct = 0;
+		for(b=0; b<nband; b++){
+			sig[b] = mix64(base ^ mix64(sig[b] + b));
+			for(cs=Csig_hash[sig[b] & (Csig_hash_size-1)]; cs; cs=cs->next){
+				q = cs->p;
+				if( cs->key != sig[b] || q->ctried == p->cindex )
+					continue;
+				q->ctried = p->cindex;
+				if( orig && q->cindex > orig->cindex )
+					continue;	// already have an earlier one
+				if( q->vcount != p->vcount || q->nmaps != p->nmaps || strcmp(proc_name(q),proc_name(p)) != 0 )
+					continue;	// different value lists or names
+				if( (pct=clone_percent(q,p)) > 95 ){
+					orig = q;
+					origpct = pct;
+					}
+				}
+			}
+
+		if( orig ){
+			p->isclone = true;
+			if( nmatch >= match_size ){
+				match_size = match_size ? match_size*2 : 64;
+				match = (cmatch_t *)realloc(match,match_size*sizeof(*match));
+				if( match==NULL ){
+					printf("Out of memory\n");
+					exit(1);
+					}
+				}
+			match[nmatch].orig = orig;
+			match[nmatch].clone = p;
+			match[nmatch++].percent = origpct;
+			continue;
+			}
+		for(b=0; b<nband; b++){	// p may be the original of later procs
+			cs = &Csig[Ncsig++];
+			cs->key = sig[b];
+			cs->p = p;
+			cs->next = Csig_hash[sig[b] & (Csig_hash_size-1)];
+			Csig_hash[sig[b] & (Csig_hash_size-1)] = cs;
+			}
+		}
+
+	// report them in the order a pairwise walk of the proc list would find them
+	if( !(Procwatch && Verbose) || Quiet )
+		return;
+	qsort(match,nmatch,sizeof(*match),cmatch_cmp);
+	for(i=0; i<nmatch; i++){
+		p = match[i].clone;
+		if( Binary ){
+			bin_pid(p);
+			ob_byte(Out,REC_CLONE);
+			ob_varint(Out,match[i].percent);
+			ob_varint(Out,match[i].orig->pid);
+			}
+		else {
+			pid_display(p);
+			out("%d%% clone of %d\n",match[i].percent,match[i].orig->pid);
+			}
+		}
+}
+
+// -K: fold how fast a process' counters grew this pass into its kgrowth
+static inline void
+topk_fold(proc_t *p)
+{
+	p->kgrowth += (p->kpass - p->kgrowth)/TOPK_WINDOW;
+	p->kpass = 0;
+}
+
+// -K: sample the counters of a process not read in full, update_user() does
+// it for one that is
+void
+topk_sample(proc_t *p)
+{
+	char *buf = pid_read(p,PF_STATUS);
+	int dir = -1, fds = -1;
+
+	if( buf == NULL )
+		return;
+	topk_status(p,buf);
+	if( Filewatch ){	// just count them, only a process in the top gets its links read
+		fds = fd_list(p,&dir);
+		if( dir >= 0 && dir != p->fddir )
+			close(dir);
+		if( fds < 0 )
+			drop_fd(&p->fddir);	// may be stale, open it afresh next pass
+		}
+	topk_fds(p,fds);
+	topk_fold(p);
+}
+
+// -K: make the Topk fastest growing processes the ones read in full next pass,
+// leaving out any that aren't growing at all
+// A min-heap of Topk on kgrowth does it in one walk of the processes.  Those
+// already in have first go at the places, so equals don't swap in and out.
+void
+topk_select(void)
+{
+	static proc_t **heap;
+	unsigned int n = 0, i, c, round;
+	proc_t *p;
+
+	if( heap == NULL && (heap=(proc_t **)malloc(Topk*sizeof(*heap))) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	for(round=0; round<2; round++)
+		for(p=Phead.pnext; p != &Phead; p=p->pnext){
+			if( p->ktop != (round == 0) || p->kgrowth <= 0 || p->evicted || p->pid == 0 || p->pid == (unsigned int)Hawk_pid )
+				continue;	// not growing, or not a candidate at all
+			if( n < Topk ){	// room for it, sift up
+				for(i=n++; i > 0 && heap[(i-1)/2]->kgrowth > p->kgrowth; i=(i-1)/2)
+					heap[i] = heap[(i-1)/2];
+				heap[i] = p;
+				}
+			else if( p->kgrowth > heap[0]->kgrowth ){	// it takes the slowest one's place, sift down
+				for(i=0; (c=2*i+1) < n; i=c){
+					if( c+1 < n && heap[c+1]->kgrowth < heap[c]->kgrowth )
+						c++;
+					if( heap[c]->kgrowth >= p->kgrowth )
+						break;
+					heap[i] = heap[c];
+					}
+				heap[i] = p;
+				}
+			}
+	for(p=Phead.pnext; p != &Phead; p=p->pnext)
+		p->ktop = false;
+	for(i=0; i<n; i++)
+		heap[i]->ktop = true;
+}
+
+// Update all user values of a process
+// Its /proc files are opened the first time and held for later passes
+void
+update_user(proc_t *p)
+{
+	long long int t = self_clock();
+
+	update_pid_status(p);
+	t = self_time(SELF_STATUS,t);
+	if( Stat_mask ){
+		update_pid_stat(p);
+		t = self_time(SELF_STAT,t);
+		}
+	if( Memwatch && Verbose){
+		update_pid_statm(p);
+		t = self_time(SELF_STATM,t);
+		if( !p->trimmed ){
+			update_pid_maps(p);
+			t = self_time(SELF_MAPS,t);
+			}
+		}
+	if( Smapswatch ){
+		update_pid_smaps(p);
+		t = self_time(SELF_SMAPS,t);
+		}
+	if( Filewatch ){
+		if( p->trimmed )
+			update_pid_fdcount(p);
+		else
+			update_pid_fd(p);
+		self_time(SELF_FD,t);
+		}
+}
+
+static inline int
+discard(char **pos, int nlines)
+{
+	while(nlines--){
+		if( next_line(pos) == NULL )
+			return 0;
+		}
+	return 1;
+}
+
+void
+update_system_slabinfo(proc_t *p)
+{
+	char *pos = sys_read(SF_SLABINFO);
+	char *buf;
+	char slabname[BUFSIZE];
+	char name[BUFSIZE];
+	unsigned long long int active_objs;
+
+	if(pos==NULL)return;
+	if( !discard(&pos,2) ){
+		out("system_slabinfo\n");	// skip version number
+		return;
+		}
+	while( (buf=next_line(&pos)) != NULL ){
+		sscanf(buf,"%s %llu", slabname,&active_objs);
+		snprintf(name,sizeof(name),"SLAB-%s",slabname);
+		val_update_int(p,name,active_objs);
+		}
+}
+
+void
+update_system_meminfo(proc_t *p)
+{
+	char *pos = sys_read(SF_MEMINFO);
+	char *buf;
+	char miname[BUFSIZE];
+	char name[BUFSIZE];
+	long long int mi;
+
+	if(pos==NULL)return;
+	if( !discard(&pos,3) ){ // skip header, mem summary, swap summary
+		out("system_meminfo\n");
+		return;
+		}
+
+	while( (buf=next_line(&pos)) != NULL ){
+		sscanf(buf,"%s %lld",miname,&mi);
+		miname[strlen(miname)-1]='\0';	// trim trailing :
+		snprintf(name,sizeof(name),"MEM-%s",miname);
+		val_update_int(p,name,mi);
+		}
+}
+
+void
+update_system_vmstat(proc_t *p)
+{
+	char *pos = sys_read(SF_VMSTAT);
+	char *buf;
+	char vmname[BUFSIZE];
+	char name[BUFSIZE];
+	long long int mi;
+
+	if(pos==NULL)return;
+	while( (buf=next_line(&pos)) != NULL ){
+		sscanf(buf,"%s %lld",vmname,&mi);
+		snprintf(name,sizeof(name),"VM-%s",vmname);
+		val_update_int(p,name,mi);
+		}
+}
+
+void
+update_system_stat(proc_t *p)
+{
+	char *pos = sys_read(SF_STAT);
+	char *buf;
+	char name[BUFSIZE];
+	long long int v;
+	long long int t[10];
+
+	if(pos==NULL)return;
+	while( (buf=next_line(&pos)) != NULL ){
+		sscanf(buf,"%s %lld",name,&v);
+		if( strcmp(name,"cpu")==0 ){
+			// 2.6 kernel has 10 buckets for cpu ticks
+			if( sscanf(buf,"%s %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",name,&t[0],&t[1],&t[2],&t[3],&t[4],&t[5],&t[6],&t[7],&t[8],&t[9]) == 11 ){
+				val_update_int(p,"Tick-User",t[0]);
+				val_update_int(p,"Tick-Nice",t[1]);
+				val_update_int(p,"Tick-System",t[2]);
+				val_update_int(p,"Tick-Idle",t[3]);
+				val_update_int(p,"Tick-Wait",t[4]);
+				val_update_int(p,"Tick-Irq",t[5]);
+				val_update_int(p,"Tick-SoftIrq",t[6]);
+				val_update_int(p,"Tick-Steal",t[7]);
+				val_update_int(p,"Tick-RTUser",t[8]);
+				val_update_int(p,"Tick-RTSystem",t[9]);
+				}
+			// 2.4 kernel has 4 buckets for cpu ticks
+			else if( sscanf(buf,"%s %lld %lld %lld %lld",name,&t[0],&t[1],&t[2],&t[3]) == 5 ){
+				val_update_int(p,"Tick-User",t[0]);
+				val_update_int(p,"Tick-Nice",t[1]);
+				val_update_int(p,"Tick-System",t[2]);
+				val_update_int(p,"Tick-Idle",t[3]);
+				}
+
+			}
+		else if( strcmp(name,"ctxt")==0 )
+			val_update_int(p,"ContextSwitch",v);
+		else if( strcmp(name,"processes")==0 )
+			val_update_int(p,"Processes",v);
+		else if( strcmp(name,"procs_running")==0 )
+			val_update_int(p,"Running",v);
+		else if( strcmp(name,"procs_blocked")==0 )
+			val_update_int(p,"Blocked",v);
+		}
+}
+
+void
+update_system_yaffs(proc_t *p)
+{
+	char *pos = sys_read(SF_YAFFS);
+	char *buf;
+	char device[BUFSIZE];
+	char item[BUFSIZE];
+	char tmp[BUFSIZE];
+	int dnum;
+	long long int val;
+	char *s;
+
+	if(pos==NULL)return;
+	strcpy(device,"???");
+
+	while( (buf=next_line(&pos)) != NULL ){
+		if( strncmp(buf,"Device ",7)==0 ){
+			sscanf(buf,"%s %d \"%s\n",tmp,&dnum,device);
+			device[strlen(device)-1]='\0';	// trim trailing "
+			}
+		else if( islower(buf[0]) ){
+			sscanf(buf,"%s %lld",item,&val);
+			for(s = &item[strlen(item)-1]; s>item && *s=='.'; s--)	// trim trailing ...
+				*s = '\0';
+			snprintf(tmp,sizeof(tmp),"YAFFS-%s-%s",device,item);
+			val_update_int(p,tmp,val);
+			}
+		else
+			{}	// ignore
+		}
+}
+
+void
+update_system_disk(proc_t *p)
+{
+	char *pos = sys_read(SF_DISKSTATS);
+	char *buf;
+	char device[BUFSIZE];
+	char tmp[BUFSIZE];
+	long long int major,minor,reads,rmerge,sectors,read_time,writes;	// there are more, but only want read/write
+
+	if(pos==NULL)return;
+	while( (buf=next_line(&pos)) != NULL ){
+		if( sscanf(buf,"%lld %lld %s %lld %lld %lld %lld %lld",&major,&minor,device,&reads,&rmerge,&sectors,&read_time,&writes) == 8 ){
+			no_white(device);	// unlikely, but possible?
+			sprintf(tmp,"%s-read",device);
+			val_update_int(p,tmp,reads);
+			sprintf(tmp,"%s-write",device);
+			val_update_int(p,tmp,writes);
+			}
+		}
+}
+
+void
+update_system(void)
+{
+	proc_t *p = lookup_proc(0);
+
+	proc_announce(p);
+	p->lastsample = Pass;
+	val_update_str(p,"Name","KERNEL");
+	if(Memwatch){
+		update_system_slabinfo(p);
+		update_system_meminfo(p);
+		update_system_vmstat(p);
+		}
+	if(Timewatch)
+		update_system_stat(p);
+	if(Yaffswatch)
+		update_system_yaffs(p);
+	if(Diskwatch)
+		update_system_disk(p);
+}
+
+// show what the last pass cost as the values of a HAWK process, with hawk's pid
+void
+update_self(void)
+{
+	proc_t *p = lookup_proc(Hawk_pid);
+	int i;
+
+	proc_announce(p);
+	p->lastsample = Pass;
+	val_update_str(p,"Name","HAWK");
+	for(i=0; i<SELF_COUNT; i++){
+		val_update_int(p,Self_name[i],i < SELF_TIMES ? Self_total[i]/1000 : Self_total[i]);
+		Self_total[i] = 0;
+		}
+}
+
+// -P -n -U -C: which pids to look at, decided before they get a proc_t
+// Filters are sorted by kind.  Any exclude that matches rules a pid out, and
+// for each kind that has includes, one of them has to match.
+typedef struct filter {
+	enum fkind { FILT_PID, FILT_UID, FILT_NAME, FILT_CGROUP, FILT_KINDS } kind;	// cheapest first
+	bool		exclude;	// given with a leading !
+	long		num;		// pid or uid
+	const char	*glob;		// name or cgroup path pattern
+} filter_t;
+filter_t	*Filters = NULL;
+int	Nfilters = 0;
+bool	Filter_include[FILT_KINDS];	// some include of this kind was given
+
+// what the filters said about a pid last time, so most passes it costs a hash probe
+// Kept in two tables, the one being filled for this pass and last pass's,
+// so pids that have gone drop out without being looked for
+typedef struct fverdict {
+	int		pid;		// 0 for an empty slot
+	bool		wanted;
+	unsigned long long int	ino;	// of /proc/<pid>, a new process with the same pid has another
+} fverdict_t;
+fverdict_t	*Fcache = NULL, *Fcache_next = NULL;
+unsigned int	Fcache_size = 0, Fcache_next_size = 0;	// powers of 2
+unsigned int	Fcache_next_count = 0;
+
+static int
+filter_cmp(const void *a, const void *b)
+{
+	return (int)((const filter_t *)a)->kind - (int)((const filter_t *)b)->kind;
+}
+
+static void
+filter_add(enum fkind kind, const char *arg)
+{
+	filter_t *f;
+	struct passwd *pw;
+	char *end;
+
+	if( (Filters=(filter_t *)realloc(Filters,(Nfilters+1)*sizeof(*Filters))) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	f = &Filters[Nfilters++];
+	f->kind = kind;
+	if( (f->exclude = *arg == '!') )
+		arg++;
+	f->glob = arg;
+	f->num = strtol(arg,&end,10);
+	if( kind == FILT_UID && (*arg == '\0' || *end != '\0') ){	// a user name
+		if( (pw=getpwnam(arg)) == NULL ){
+			printf("No user %s\n",arg);
+			exit(1);
+			}
+		f->num = pw->pw_uid;
+		}
+	if( !f->exclude )
+		Filter_include[kind] = true;
+	qsort(Filters,Nfilters,sizeof(*Filters),filter_cmp);
+}
+
+// read a small /proc/<pid> file, return its length or -1
+static int
+filter_read(int pid, const char *name, char *buf, int size)
+{
+	char path[BUFSIZE];
+	int fd, n;
+
+	snprintf(path,sizeof(path),"%s/%d/%s",Proc_root,pid,name);
+	Self[SELF_OPENS]++;
+	if( (fd=open(path,O_RDONLY)) < 0 )
+		return -1;
+	n = read(fd,buf,size-1);
+	Self[SELF_READS]++;
+	close(fd);
+	if( n < 0 )
+		return -1;
+	buf[n] = '\0';
+	return n;
+}
+
+// does any line of /proc/<pid>/cgroup have a path matching glob
+static bool
+cgroup_match(char *cg, const char *glob)
+{
+	char *line, *path, *save;
+	char buf[BUFSIZE];
+
+	strcpy(buf,cg);	// strtok_r writes into it
+	for(line=strtok_r(buf,"\n",&save); line; line=strtok_r(NULL,"\n",&save))
+		if( (path=strchr(line,':')) != NULL && (path=strchr(path+1,':')) != NULL && fnmatch(glob,path+1,0)==0 )
+			return true;
+	return false;
+}
+
+// run the filters on a pid, reading only what they need
+static bool
+filter_check(int pid)
+{
+	char path[BUFSIZE], comm[MAXPNAME+1], cg[BUFSIZE];
+	bool matched = false, have_comm = false, have_cg = false, have_uid = false, m = false;
+	struct stat st;
+	filter_t *f;
+	uid_t uid = 0;
+	int i, n;
+
+	for(i=0; i<Nfilters; i++){
+		f = &Filters[i];
+		switch(f->kind){
+		case FILT_PID:
+			m = f->num == pid;
+			break;
+		case FILT_UID:
+			if( !have_uid ){
+				snprintf(path,sizeof(path),"%s/%d",Proc_root,pid);
+				if( stat(path,&st) < 0 )
+					return false;	// gone
+				uid = st.st_uid;
+				have_uid = true;
+				}
+			m = f->num == (long)uid;
+			break;
+		case FILT_NAME:
+			if( !have_comm ){
+				if( (n=filter_read(pid,"comm",comm,sizeof(comm))) < 0 )
+					return false;
+				if( n && comm[n-1] == '\n' )
+					comm[n-1] = '\0';
+				have_comm = true;
+				}
+			m = fnmatch(f->glob,comm,0)==0;
+			break;
+		case FILT_CGROUP:
+			if( !have_cg ){
+				if( filter_read(pid,"cgroup",cg,sizeof(cg)) < 0 )
+					return false;
+				have_cg = true;
+				}
+			m = cgroup_match(cg,f->glob);
+			break;
+		case FILT_KINDS:
+			break;
+			}
+		if( m && f->exclude )
+			return false;
+		matched |= m && !f->exclude;
+		if( i == Nfilters-1 || Filters[i+1].kind != f->kind ){	// last of this kind
+			if( Filter_include[f->kind] && !matched )
+				return false;
+			matched = false;
+			}
+		}
+	return true;
+}
+
+static inline fverdict_t *
+fcache_slot(fverdict_t *t, unsigned int size, int pid)
+{
+	unsigned int i = pid_hash(pid) & (size-1);
+
+	while( t[i].pid != 0 && t[i].pid != pid )
+		i = (i+1) & (size-1);
+	return &t[i];
+}
+
+// should readdir's pid be looked at this pass
+// The verdict is reused until FILTER_RECHECK passes have gone by, in case of exec
+static bool
+filter_pass(int pid, unsigned long long int ino)
+{
+	fverdict_t *fv, *old = NULL, *t;
+	unsigned int i, size;
+	bool wanted;
+
+	if( Fcache_size )
+		old = fcache_slot(Fcache,Fcache_size,pid);
+	if( old && old->pid == pid && old->ino == ino && (Pass+pid) % FILTER_RECHECK != 0 )
+		wanted = old->wanted;
+	else
+		wanted = filter_check(pid);
+
+	if( (Fcache_next_count+1)*2 > Fcache_next_size ){
+		t = Fcache_next;
+		size = Fcache_next_size;
+		Fcache_next_size = size ? size*2 : 1024;
+		if( (Fcache_next=(fverdict_t *)calloc(Fcache_next_size,sizeof(*Fcache_next))) == NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		for(i=0; i<size; i++)
+			if( t[i].pid )
+				*fcache_slot(Fcache_next,Fcache_next_size,t[i].pid) = t[i];
+		free(t);
+		}
+	fv = fcache_slot(Fcache_next,Fcache_next_size,pid);
+	if( fv->pid == 0 )
+		Fcache_next_count++;
+	fv->pid = pid;
+	fv->ino = ino;
+	fv->wanted = wanted;
+	return wanted;
+}
+
+// readdir is done, this pass's verdicts are the ones to go by next pass
+static void
+filter_pass_end(void)
+{
+	fverdict_t *t = Fcache;
+	unsigned int size = Fcache_size;
+
+	Fcache = Fcache_next;
+	Fcache_size = Fcache_next_size;
+	Fcache_next = t;
+	Fcache_next_size = size;
+	Fcache_next_count = 0;
+	if( t )
+		memset(t,0,size*sizeof(*t));
+}
+
+static int
+proc_pid_cmp(const void *a, const void *b)
+{
+	unsigned int p1 = (*(proc_t * const *)a)->pid, p2 = (*(proc_t * const *)b)->pid;
+
+	return p1 < p2 ? -1 : p1 > p2;
+}
+
+static inline void
+scan_add(proc_t *p)
+{
+	if( Nscan >= Scan_size ){
+		Scan_size = Scan_size ? Scan_size*2 : 1024;
+		Scan = (proc_t **)realloc(Scan,Scan_size*sizeof(*Scan));
+		if( Scan==NULL ){
+			printf("Out of memory\n");
+			exit(1);
+			}
+		}
+	Scan[Nscan++] = p;
+}
+
+// will scan_procs() read this process' files this pass?
+static inline bool
+scan_due(proc_t *p)
+{
+	if( Adaptive && p->lastsample != (unsigned int)-1 && Pass - p->lastsample < p->backoff )
+		return false;	// not due yet
+	return !p->isclone && !p->evicted;
+}
+
+static void
+uring_close(uring_t *u)
+{
+	if( u->sqes != MAP_FAILED )
+		munmap(u->sqes,u->sqes_size);
+	if( u->cq_map != MAP_FAILED && u->cq_map != u->sq_map )
+		munmap(u->cq_map,u->cq_size);
+	if( u->sq_map != MAP_FAILED )
+		munmap(u->sq_map,u->sq_size);
+	close(u->fd);
+	free(u->buf);
+	free(u);
+}
+
+// set up an io_uring for this thread, NULL if the kernel won't
+static uring_t *
+uring_open(void)
+{
+	struct io_uring_params par;
+	uring_t *u;
+	int fd;
+
+	memset(&par,0,sizeof(par));
+	if( (fd=syscall(__NR_io_uring_setup,URING_ENTRIES,&par)) < 0 )
+		return NULL;
+	u = (uring_t *)calloc(1,sizeof(*u));
+	if( u==NULL || (u->buf=(char *)malloc(URING_BATCH*URING_SLOT)) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
+	u->fd = fd;
+	u->sq_size = par.sq_off.array + par.sq_entries*sizeof(unsigned int);
+	u->cq_size = par.cq_off.cqes + par.cq_entries*sizeof(struct io_uring_cqe);
+	u->sqes_size = par.sq_entries*sizeof(struct io_uring_sqe);
+	if( par.features & IORING_FEAT_SINGLE_MMAP ){	// both rings in one mapping
+		if( u->cq_size > u->sq_size )
+			u->sq_size = u->cq_size;
+		u->cq_size = u->sq_size;
+		}
+	u->sq_map = mmap(NULL,u->sq_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+	u->cq_map = u->sq_map;
+	if( !(par.features & IORING_FEAT_SINGLE_MMAP) )
+		u->cq_map = mmap(NULL,u->cq_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+	u->sqes = (struct io_uring_sqe *)mmap(NULL,u->sqes_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+	if( u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED ){
+		uring_close(u);
+		return NULL;
+		}
+	u->sq_tail = (unsigned int *)((char *)u->sq_map + par.sq_off.tail);
+	u->sq_mask = (unsigned int *)((char *)u->sq_map + par.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)((char *)u->sq_map + par.sq_off.array);
+	u->cq_head = (unsigned int *)((char *)u->cq_map + par.cq_off.head);
+	u->cq_tail = (unsigned int *)((char *)u->cq_map + par.cq_off.tail);
+	u->cq_mask = (unsigned int *)((char *)u->cq_map + par.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_map + par.cq_off.cqes);
+	return u;
+}
+
+// the processes of the last batch have nothing read for them any more
+static inline void
+uring_forget(uring_t *u)
+{
+	int i;
+
+	for(i=0; i<u->nbatch; i++)
+		u->batch[i]->uslot = -1;
+	u->nbatch = 0;
+}
+
+// where file w goes in a process' slot
+static inline unsigned int
+uring_off(int w)
+{
+	unsigned int off = 0;
+
+	while( w-- )
+		off += Uring_size[w];
+	return off;
+}
+
+// the files of a process update_user(), or topk_sample() alone, will read
+// and that can come whole from one read
+static inline unsigned int
+uring_wanted(proc_t *p)
+{
+	unsigned int want = 1u<<PF_STATUS;
+
+	if( Topk && !p->ktop )
+		return want;
+	if( Stat_mask )
+		want |= 1u<<PF_STAT;
+	if( Memwatch && Verbose )
+		want |= 1u<<PF_STATM;
+	if( Smapswatch )
+		want |= 1u<<PF_SMAPS;
+	return want;
+}
+
+// read the files a batch of processes is about to have read, all with one
+// io_uring_enter(), for pid_read() to hand out.  Only files already held
+// open are queued, and one that fills its room or fails is left for
+// pid_read() to read as usual.
+static void
+uring_prefetch(uring_t *u, proc_t **procs, int nprocs)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned int tail, head, want, queued = 0, done = 0, slot;
+	int i, w, n, submit;
+	proc_t *p;
+	char *buf;
+
+	uring_forget(u);
+	tail = *u->sq_tail;
+	for(i=0; i<nprocs; i++){
+		p = procs[i];
+		if( !scan_due(p) )
+			continue;
+		want = uring_wanted(p);
+		for(w=0; w<PF_COUNT; w++){
+			u->pre[u->nbatch][w] = NULL;
+			if( !(want & (1u<<w)) || p->fds[w] < 0 )
+				continue;
+			sqe = &u->sqes[tail & *u->sq_mask];
+			memset(sqe,0,sizeof(*sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = p->fds[w];
+			sqe->addr = (unsigned long)(u->buf + u->nbatch*URING_SLOT + uring_off(w));
+			sqe->len = Uring_size[w]-1;	// leave room for the NUL
+			sqe->user_data = u->nbatch*PF_COUNT + w;
+			u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+			tail++;
+			queued++;
+			}
+		p->uslot = u->nbatch;
+		u->batch[u->nbatch++] = p;
+		}
+	if( queued == 0 )
+		return;
+	__atomic_store_n(u->sq_tail,tail,__ATOMIC_RELEASE);
+
+	for(submit=queued; done < queued; ){
+		Self[SELF_READS]++;
+		if( (n=syscall(__NR_io_uring_enter,u->fd,submit,queued-done,IORING_ENTER_GETEVENTS,NULL,0)) < 0 ){
+			if( errno == EINTR )
+				continue;
+			break;	// take what has completed, the rest is read as usual
+			}
+		submit -= n;
+		for(head = *u->cq_head; head != __atomic_load_n(u->cq_tail,__ATOMIC_ACQUIRE); head++, done++){
+			cqe = &u->cqes[head & *u->cq_mask];
+			slot = cqe->user_data / PF_COUNT;
+			w = cqe->user_data % PF_COUNT;
+			if( cqe->res < 0 || (unsigned int)cqe->res >= Uring_size[w]-1 )
+				continue;	// failed or may be longer, pid_read() will see
+			buf = u->buf + slot*URING_SLOT + uring_off(w);
+			buf[cqe->res] = '\0';
+			u->pre[slot][w] = buf;
+			Self[SELF_BYTES] += cqe->res;
+			}
+		__atomic_store_n(u->cq_head,head,__ATOMIC_RELEASE);
+		}
+	if( done < queued ){	// the ring is in an unknown state, go back to reading one at a time
+		uring_forget(u);
+		uring_close(u);
+		Ur = NULL;
+		}
+}
+
+// update a run of processes from Scan[]
+static void
+scan_procs(proc_t **procs, int nprocs)
+{
+	proc_t *p;
+	int dfd, i;
+
+	for(i=0; i<nprocs; i++){
+		if( Ur && i % URING_BATCH == 0 )
+			uring_prefetch(Ur,procs+i,nprocs-i < URING_BATCH ? nprocs-i : URING_BATCH);
+		p = procs[i];
+		proc_announce(p);
+		if( p->evicted )
+			evict_recheck(p);
+		if( !scan_due(p) )
+			continue;
+		if( (dfd=pid_opendir(p)) >= 0 ){	// open may fail if process exited since readdir saw it
+			pid_closedir(p,dfd);
+			if( Topk && !p->ktop ){
+				topk_sample(p);
+				continue;	// not read in full, its values stay as they were
+				}
+			update_user(p);
+			if( Topk )
+				topk_fold(p);
+			p->lastsample = Pass;
+			// back off while nothing changes, straight back to every pass when it does
+			if( p->lastchange == Pass )
+				p->backoff = 1;
+			else if( p->backoff < BACKOFF_MAX )
+				p->backoff *= 2;
+			}
 		}
+	if( Ur )
+		uring_forget(Ur);
 }
 
-void
-update_pid_statm(proc_t *p, const char *path)
+// scan thread: take chunks until there are none left
+static void *
+scan_thread(void *arg)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	int nscan;
-	long long int size,resident,share,trs,lrs,drs,dt;
+	outbuf_t *was = Out;
+	int i;
 
-	if(fp==NULL)return;
-	buf[0] = '\0';
-	fgets(buf,sizeof(buf),fp);
-	fclose(fp);
-	if(buf[0]=='\0')
-		return;
-		
-	nscan = sscanf(buf,"%lld %lld %lld %lld %lld %lld %lld\n",
-		&size, &resident, &share, &trs, &lrs, &drs, &dt);
-	if(nscan != 7 ){
-		printf("pid_statm scan? %d\n",nscan);
-		return;
+	while( (i=__atomic_fetch_add(&Next_chunk,1,__ATOMIC_RELAXED)) < Nchunks ){
+		Out = &Chunks[i].out;
+		scan_procs(Chunks[i].procs,Chunks[i].nprocs);
 		}
-	val_update_int(p,"TextRSS",trs);
-	val_update_int(p,"LibRSS",lrs);
-	val_update_int(p,"DataRSS",drs);
-	val_update_int(p,"Dirty",dt);
+	Out = was;
+	self_merge();
+	return arg;
 }
 
-void
-update_pid_maps(proc_t *p, const char *path)
+// a scan thread of its own: hand back what it holds before it goes,
+// each pass has new ones.  Its io_uring stays with its slot for the next.
+static void *
+scan_worker(void *arg)
 {
-	FILE *fp = fopen(path,"r");
-	char *dash;
-	char *range_end;
-	char buf[BUFSIZE];
-	unsigned long long mstart;
-	unsigned long long mend;
-	char name[BUFSIZE];
+	long slot = (long)arg;
 
-	if(fp==NULL)return;
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		dash = strchr(buf,'-');
-		if( dash==NULL )
-			continue;
-		if( sscanf(buf,"%llx-%llx",&mstart,&mend) != 2 ){
-			continue;
-			}
-		sprintf(name,"Mmap-%016llx",mstart);
-		val_update_int(p,name,mend);
-		}
-	fclose(fp);
+	if( Uring && (Ur=Worker_ur[slot]) == NULL )
+		Ur = uring_open();
+	scan_thread(arg);
+	if( Uring )
+		Worker_ur[slot] = Ur;	// NULL if uring_prefetch() gave up on it
+	val_share();
+	free(Rbuf);
+	free(Mscratch);
+	free(Fdscratch);
+	free(Dentbuf);
+	return arg;
 }
 
-void
-update_pid_fd(proc_t *p, const char *path)
+// update everything in Scan[], spread over Nthreads threads
+// Each chunk collects its own output and they are printed in Scan[] order,
+// so the result is the same as updating them one at a time
+static void
+scan_all(void)
 {
-	DIR	*d = opendir(path);
-	struct dirent	*e;
-	int	linklen;
-	int	fd;
-	char	link[BUFSIZE];
-	char	buf[BUFSIZE];
-	int	fd_count = 0;
+	pthread_t tid[Nthreads];
+	int i, nt;
+
+	if( Nthreads <= 1 || Nscan <= CHUNK_PROCS ){
+		scan_procs(Scan,Nscan);
+		return;
+		}
 
-	if(d==NULL)return;
-	while( (e=readdir(d)) ){
-		fd = strtol(e->d_name,NULL,10);
-		sprintf(buf,"%s/%d",path,fd);
-		linklen = readlink(buf,link,sizeof(link)-1);
-		if( linklen > 0 ){
-			link[linklen] = '\0';
-			sprintf(buf,"Fd%d",fd);
-			val_update_str(p,buf,link);
-			fd_count++;
+	Nchunks = (Nscan+CHUNK_PROCS-1)/CHUNK_PROCS;
+	if( Nchunks > Chunks_size ){
+		Chunks = (chunk_t *)realloc(Chunks,Nchunks*sizeof(*Chunks));
+		if( Chunks==NULL ){
+			printf("Out of memory\n");
+			exit(1);
 			}
+		memset(&Chunks[Chunks_size],0,(Nchunks-Chunks_size)*sizeof(*Chunks));
+		Chunks_size = Nchunks;
 		}
-	closedir(d);
-	val_update_int(p,"FdCount",fd_count);
-}
+	for(i=0; i<Nchunks; i++){
+		Chunks[i].procs = &Scan[i*CHUNK_PROCS];
+		Chunks[i].nprocs = i < Nchunks-1 ? CHUNK_PROCS : Nscan-i*CHUNK_PROCS;
+		Chunks[i].out.len = 0;
+		Chunks[i].out.lastpid = -1;
+		}
+	Next_chunk = 0;
 
-void
-val_cleanup(proc_t *p, val_t *v)
-{
-	val_update_str(p,v->name,"");
-	val_free(v);
-	p->vcount--;
+	val_share();	// let the threads reuse whatever the last cleanup freed
+	for(nt=0; nt<Nthreads-1; nt++)
+		if( pthread_create(&tid[nt],NULL,scan_worker,(void *)(long)nt) != 0 )
+			break;	// carry on with the threads we have
+	scan_thread(NULL);
+	for(i=0; i<nt; i++)
+		pthread_join(tid[i],NULL);
+
+	for(i=0; i<Nchunks; i++)
+		if( Chunks[i].out.len == 0 )
+			continue;
+		else {
+			show_pass();
+			ob_bytes(Out,Chunks[i].out.buf,Chunks[i].out.len);
+			Out->lastpid = -1;	// binary records carry on from here
+			}
 }
 
-void
-proc_cleanup(proc_t *p)
+// subscribe to process fork/exec/exit events, return false if we can't
+// The proc connector needs CAP_NET_ADMIN
+static bool
+events_open(void)
 {
-	val_t	*v;
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC };
+	union {
+		struct nlmsghdr	nl;
+		char		buf[NLMSG_SPACE(sizeof(struct cn_msg)+sizeof(enum proc_cn_mcast_op))];
+	} req;
+	struct cn_msg *cn;
+	int rcvbuf = 1024*1024;
 
-	while( (v=p->vlist.vnext) != &p->vlist )	// reclaim all valinfo structures
-		val_free(v);
-	proc_free(p);
+	if( (Evfd=socket(PF_NETLINK,SOCK_DGRAM|SOCK_CLOEXEC,NETLINK_CONNECTOR)) < 0 )
+		return false;
+	setsockopt(Evfd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+	memset(&req,0,sizeof(req));
+	req.nl.nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg)+sizeof(enum proc_cn_mcast_op));
+	req.nl.nlmsg_type = NLMSG_DONE;
+	cn = (struct cn_msg *)NLMSG_DATA(&req.nl);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(enum proc_cn_mcast_op);
+	*(enum proc_cn_mcast_op *)cn->data = PROC_CN_MCAST_LISTEN;
+	if( bind(Evfd,(struct sockaddr *)&sa,sizeof(sa)) < 0 || send(Evfd,&req,req.nl.nlmsg_len,0) < 0 ){
+		close(Evfd);
+		Evfd = -1;
+		return false;
+		}
+	return true;
 }
 
-// scan cache for anything that has disappeared
-// this can be either values stored, or whole processes
-void
-cleanup(void)
+static void
+event_exit(int pid)
 {
-	proc_t	*p,*p2;
-	val_t	*v, *v2;
+	proc_t *p = NULL;
 
-	for(p=Phead.pnext; p != &Phead; p=p->pnext)
-		if( p->lastupdate != Pass ){	// not seen this pass
-			p2 = p->pprev;	// resume scan at previous
-			proc_cleanup(p);
-			p = p2;
-			}
-		else if( !p->isclone){	// if not a clone, check if any values have disappeared
-			for(v=p->vlist.vnext; v != &p->vlist; v=v->vnext)
-				if( v->lastupdate != Pass ){
-					v2 = v->vprev;	// resume scan at previous
-					val_cleanup(p,v);
-					v = v2;
-					}
-			}
+	if( Phash_size )
+		for(p=Phash[pid_hash(pid)]; p; p=p->hnext)
+			if( p->pid == pid )
+				break;
+	if( p && pid != 0 )
+		proc_cleanup(p);
 }
 
-// scan vlist, looking for an exact match for v
-int
-valmatch(val_t *v, val_t *list)
+// a process started or exec'd, pick it up now rather than at the next pass
+static void
+event_start(int pid, bool exec)
 {
-	val_t	*vscan;
+	proc_t *p;
 
-	// don't insist on a match for these
-	if( strcmp(v->name,"PPid")==0 || strcmp(v->name,"TaskFlags")==0 )
-		return 1;
-	for(vscan = list->vnext; vscan != list; vscan=vscan->vnext)
-		if( strcmp(v->name,vscan->name)==0 )	// found the right name
-			return strcmp(v->val,vscan->val)==0 ;
-	return 0;
+	if( pid == Hawk_pid )
+		return;
+	if( Nfilters && !filter_check(pid) ){
+		if( exec )	// it may have been wanted as whatever it was before
+			event_exit(pid);
+		return;
+		}
+	p = lookup_proc(pid);	// already known if readdir beat the event to it
+	if( exec ){
+		p->isclone = false;	// it is something else now
+		p->lastsample = -1;
+		p->backoff = 1;
+		}
+	else if( !p->isnew )
+		return;
+	scan_procs(&p,1);
 }
 
-// scan proc list looking for clone threads
-// if a clone is found, it is marked as such and future scans of it are skipped
-void
-clone_check(void)
+// handle whatever events are waiting, and write out what they printed
+static void
+events_read(void)
 {
-	proc_t	*p1,*p2;
-	val_t	*v;
-	char	*n1;
-	int	matchval, matchpercent;
-
-	for(p1=Phead.pnext; p1 != &Phead; p1=p1->pnext){
-		if( p1->isclone )
-			continue;	// already known clone
-		n1 = proc_name(p1);
-		for(p2=p1->pnext; p2 != &Phead; p2=p2->pnext){
-			if( p2->isclone )
-				continue;	// already known clone
-			if( p1->vcount != p2->vcount )
-				continue;	// different value lists
-			if( strcmp(n1,proc_name(p2)) != 0 )
-				continue;	// different names
-			matchval=0;
-			for(v=p1->vlist.vnext; v != &p1->vlist; v=v->vnext)
-				if( valmatch(v,&p2->vlist) )
-					matchval++;
-			matchpercent = p2->vcount ? (matchval*100)/p2->vcount : 0;
-			if( matchpercent > 95 ){
-				p2->isclone = true;
-				if(Procwatch && Verbose){
-					pid_display(p2);
-					printf("%d%% clone of %d\n",matchpercent,p1->pid);
-					}
+	union {
+		struct nlmsghdr	nl;
+		char		buf[8192];
+	} msg;
+	struct nlmsghdr *nl;
+	struct cn_msg *cn;
+	struct proc_event ev;
+	ssize_t n;
+
+	while( (n=recv(Evfd,&msg,sizeof(msg),MSG_DONTWAIT)) != 0 ){
+		if( n < 0 ){
+			if( errno == ENOBUFS )
+				Events_lost = true;	// socket overflowed
+			else if( errno != EINTR )
+				break;
+			continue;
+			}
+		for(nl = &msg.nl; NLMSG_OK(nl,n); nl = NLMSG_NEXT(nl,n)){
+			if( nl->nlmsg_type != NLMSG_DONE )
+				continue;
+			// copied out, the event is only 4 byte aligned after the headers
+			cn = (struct cn_msg *)NLMSG_DATA(nl);
+			memset(&ev,0,sizeof(ev));
+			memcpy(&ev,cn->data,cn->len < sizeof(ev) ? cn->len : sizeof(ev));
+			switch(ev.what){
+			case PROC_EVENT_FORK:
+				if( ev.event_data.fork.child_pid == ev.event_data.fork.child_tgid )	// not a new thread
+					event_start(ev.event_data.fork.child_tgid,false);
+				break;
+			case PROC_EVENT_EXEC:
+				event_start(ev.event_data.exec.process_tgid,true);
+				break;
+			case PROC_EVENT_EXIT:
+				if( ev.event_data.exit.process_pid == ev.event_data.exit.process_tgid )
+					event_exit(ev.event_data.exit.process_tgid);
+				break;
+			default:
+				break;
 				}
 			}
 		}
+	pass_flush();
 }
 
-// Update all user values of the currently selected process
-// Caller has already chdir'd to the process being updated
-void
-update_user(proc_t *p)
+static inline void
+ts_add_ms(struct timespec *ts, long ms)
 {
-	update_pid_status(p,"status");
-	update_pid_stat(p,"stat");
-	if( Memwatch && Verbose){
-		update_pid_statm(p,"statm");
-		update_pid_maps(p,"maps");
+	ts->tv_sec += ms/1000;
+	ts->tv_nsec += (ms%1000)*1000000;
+	if( ts->tv_nsec >= 1000000000 ){
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
 		}
-	if( Filewatch )
-		update_pid_fd(p,"fd");
 }
 
-static inline int
-discard(FILE *fp, int nlines)
+static inline long long int
+ts_diff_ms(const struct timespec *a, const struct timespec *b)
 {
-	char buf[BUFSIZE];
+	return (a->tv_sec-b->tv_sec)*1000LL + (a->tv_nsec-b->tv_nsec)/1000000;
+}
 
-	while(nlines--){
-		if( fgets(buf,sizeof(buf),fp) == NULL )
-			return 0;
+// wait until a CLOCK_MONOTONIC deadline (NULL for none), or until one of fds is readable,
+// handling process events as they come if we are following them
+// return the readable one, or -1 at the deadline
+static int
+wait_until(const struct timespec *end, const int *fds, int nfds)
+{
+	struct timespec now;
+	struct pollfd pfd[4];
+	long long int ms;
+	int i, n = 0;
+
+	if( nfds == 0 && Evfd < 0 ){
+		while( clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,end,NULL) == EINTR )
+			;
+		return -1;
+		}
+	for(i=0; i<nfds; i++){
+		pfd[n].fd = fds[i];
+		pfd[n++].events = POLLIN;
+		}
+	if( Evfd >= 0 ){
+		pfd[n].fd = Evfd;
+		pfd[n++].events = POLLIN;
+		}
+	for(;;){
+		ms = -1;
+		if( end ){
+			clock_gettime(CLOCK_MONOTONIC,&now);
+			if( (ms=ts_diff_ms(end,&now)) <= 0 )
+				return -1;
+			}
+		if( poll(pfd,n,ms) <= 0 )
+			continue;
+		if( Evfd >= 0 && (pfd[n-1].revents & POLLIN) )
+			events_read();
+		for(i=0; i<nfds; i++)
+			if( pfd[i].revents & POLLIN )
+				return fds[i];
 		}
-	return 1;
 }
 
-void
-update_system_slabinfo(proc_t *p, char *path)
+// start ticking every Update_interval on CLOCK_MONOTONIC
+// The ticks don't move if a pass runs long, so intervals don't drift
+static void
+timer_setup(void)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	char slabname[BUFSIZE];
-	char name[BUFSIZE];
-	unsigned long long int active_objs;
+	struct itimerspec its;
 
-	if(fp==NULL)return;
-	if( !discard(fp,2) ){
-		printf("system_slabinfo\n");	// skip version number
-		fclose(fp);
-		return;
-		}
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		sscanf(buf,"%s %llu", slabname,&active_objs);
-		snprintf(name,sizeof(name),"SLAB-%s",slabname);
-		val_update_int(p,name,active_objs);
+	its.it_interval.tv_sec = Update_interval/1000;
+	its.it_interval.tv_nsec = (Update_interval%1000)*1000000;
+	its.it_value = its.it_interval;
+	if( (Tfd=timerfd_create(CLOCK_MONOTONIC,TFD_CLOEXEC)) >= 0 && timerfd_settime(Tfd,0,&its,NULL) < 0 ){
+		close(Tfd);
+		Tfd = -1;
 		}
-	fclose(fp);
+	clock_gettime(CLOCK_MONOTONIC,&Next_tick);	// used if there is no timerfd
+	ts_add_ms(&Next_tick,Update_interval);
 }
 
-void
-update_system_meminfo(proc_t *p, char *path)
+// wait for the next tick, setting Pass_missed to the ticks that went by during the last pass
+static void
+wait_tick(void)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	char miname[BUFSIZE];
-	char name[BUFSIZE];
-	long long int mi;
+	unsigned long long int n;
+	struct timespec now;
+	long long int late;
 
-	if(fp==NULL)return;
-	if( !discard(fp,3) ){ // skip header, mem summary, swap summary
-		printf("system_meminfo\n");
-		fclose(fp);
+	if( Tfd >= 0 ){
+		while( wait_until(NULL,&Tfd,1) < 0 || read(Tfd,&n,sizeof(n)) != sizeof(n) )
+			;
+		Pass_missed = n-1;
 		return;
 		}
-
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		sscanf(buf,"%s %lld",miname,&mi);
-		miname[strlen(miname)-1]='\0';	// trim trailing :
-		snprintf(name,sizeof(name),"MEM-%s",miname);
-		val_update_int(p,name,mi);
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	if( (late=ts_diff_ms(&now,&Next_tick)) < 0 ){
+		wait_until(&Next_tick,NULL,0);
+		Pass_missed = 0;
 		}
-	fclose(fp);
+	else	// overran, start now and skip the ticks that went by
+		Pass_missed = late/Update_interval;
+	ts_add_ms(&Next_tick,Update_interval*(Pass_missed+1));
 }
 
-void
-update_system_vmstat(proc_t *p, char *path)
+// get ready to be triggered by TRIGGER_FILE appearing or by SIGUSR1
+// If inotify isn't there the file is looked for every second
+static void
+trigger_setup(void)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	char vmname[BUFSIZE];
-	char name[BUFSIZE];
-	long long int mi;
+	sigset_t mask;
 
-	if(fp==NULL)return;
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		sscanf(buf,"%s %lld",vmname,&mi);
-		snprintf(name,sizeof(name),"VM-%s",vmname);
-		val_update_int(p,name,mi);
+	if( Externaltrigger && (Ifd=inotify_init1(IN_CLOEXEC|IN_NONBLOCK)) >= 0
+	  && inotify_add_watch(Ifd,TRIGGER_DIR,IN_CREATE|IN_CLOSE_WRITE|IN_MOVED_TO) < 0 ){
+		close(Ifd);
+		Ifd = -1;
+		}
+	if( Sigtrigger ){	// blocked before any threads start, so it only comes through Sfd
+		sigemptyset(&mask);
+		sigaddset(&mask,SIGUSR1);
+		pthread_sigmask(SIG_BLOCK,&mask,NULL);
+		Sfd = signalfd(-1,&mask,SFD_CLOEXEC|SFD_NONBLOCK);
 		}
-	fclose(fp);
 }
 
-void
-update_system_stat(proc_t *p, char *path)
+// read what inotify has, return true if any of it was about TRIGGER_NAME
+static bool
+trigger_seen(void)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	char name[BUFSIZE];
-	long long int v;
-	long long int t[10];
-
-	if(fp==NULL)return;
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		sscanf(buf,"%s %lld",name,&v);
-		if( strcmp(name,"cpu")==0 ){
-			// 2.6 kernel has 10 buckets for cpu ticks
-			if( sscanf(buf,"%s %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",name,&t[0],&t[1],&t[2],&t[3],&t[4],&t[5],&t[6],&t[7],&t[8],&t[9]) == 11 ){
-				val_update_int(p,"Tick-User",t[0]);
-				val_update_int(p,"Tick-Nice",t[1]);
-				val_update_int(p,"Tick-System",t[2]);
-				val_update_int(p,"Tick-Idle",t[3]);
-				val_update_int(p,"Tick-Wait",t[4]);
-				val_update_int(p,"Tick-Irq",t[5]);
-				val_update_int(p,"Tick-SoftIrq",t[6]);
-				val_update_int(p,"Tick-Steal",t[7]);
-				val_update_int(p,"Tick-RTUser",t[8]);
-				val_update_int(p,"Tick-RTSystem",t[9]);
-				}
-			// 2.4 kernel has 4 buckets for cpu ticks
-			else if( sscanf(buf,"%s %lld %lld %lld %lld",name,&t[0],&t[1],&t[2],&t[3]) == 5 ){
-				val_update_int(p,"Tick-User",t[0]);
-				val_update_int(p,"Tick-Nice",t[1]);
-				val_update_int(p,"Tick-System",t[2]);
-				val_update_int(p,"Tick-Idle",t[3]);
-				}
+	union {
+		struct inotify_event	ev;
+		char			buf[4096];
+	} u;
+	struct inotify_event *ev;
+	bool seen = false;
+	ssize_t n;
+	char *s;
 
+	while( (n=read(Ifd,&u,sizeof(u))) > 0 )
+		for(s=u.buf; s < u.buf+n; s += sizeof(*ev)+ev->len){
+			ev = (struct inotify_event *)s;
+			if( ev->len && strcmp(ev->name,TRIGGER_NAME)==0 )
+				seen = true;
 			}
-		else if( strcmp(name,"ctxt")==0 )
-			val_update_int(p,"ContextSwitch",v);
-		else if( strcmp(name,"processes")==0 )
-			val_update_int(p,"Processes",v);
-		else if( strcmp(name,"procs_running")==0 )
-			val_update_int(p,"Running",v);
-		else if( strcmp(name,"procs_blocked")==0 )
-			val_update_int(p,"Blocked",v);
-		}
-	fclose(fp);
+	return seen;
 }
 
-void
-update_system_yaffs(proc_t *p, char *path)
+// wait for TRIGGER_FILE or SIGUSR1
+static void
+wait_trigger(void)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	char device[BUFSIZE];
-	char item[BUFSIZE];
-	char tmp[BUFSIZE];
-	int dnum;
-	long long int val;
-	char *s;
-
-	if(fp==NULL)return;
-	strcpy(device,"???");
+	struct signalfd_siginfo si;
+	struct timespec end;
+	int fds[2], n = 0, fd;
 
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		if( strncmp(buf,"Device ",7)==0 ){
-			sscanf(buf,"%s %d \"%s\n",tmp,&dnum,device);
-			device[strlen(device)-1]='\0';	// trim trailing "
-			}
-		else if( islower(buf[0]) ){
-			sscanf(buf,"%s %lld",item,&val);
-			for(s = &item[strlen(item)-1]; s>item && *s=='.'; s--)	// trim trailing ...
-				*s = '\0';
-			snprintf(tmp,sizeof(tmp),"YAFFS-%s-%s",device,item);
-			val_update_int(p,tmp,val);
+	if( Ifd >= 0 )
+		fds[n++] = Ifd;
+	if( Sfd >= 0 )
+		fds[n++] = Sfd;
+	for(;;){
+		if( Externaltrigger && (fd=open(TRIGGER_FILE,O_RDONLY,0)) >= 0 ){
+			close(fd);
+			unlink(TRIGGER_FILE);
+			return;
 			}
-		else
-			{}	// ignore
+		do {
+			if( Externaltrigger && Ifd < 0 ){	// no inotify, look again in a second
+				clock_gettime(CLOCK_MONOTONIC,&end);
+				ts_add_ms(&end,1000);
+				fd = wait_until(&end,fds,n);
+				}
+			else
+				fd = wait_until(NULL,fds,n);
+			if( fd >= 0 && fd == Sfd ){
+				while( read(Sfd,&si,sizeof(si)) == sizeof(si) )
+					;
+				return;
+				}
+			} while( fd >= 0 && !trigger_seen() );
 		}
-	fclose(fp);
 }
 
 void
-update_system_disk(proc_t *p, char *path)
+pause_for_next_pass(void)
 {
-	FILE *fp = fopen(path,"r");
-	char buf[BUFSIZE];
-	char device[BUFSIZE];
-	char tmp[BUFSIZE];
-	long long int major,minor,reads,rmerge,sectors,read_time,writes;	// there are more, but only want read/write
+	if( Externaltrigger || Sigtrigger )
+		wait_trigger();
+	else
+		wait_tick();
+}
 
-	if(fp==NULL)return;
-	while( fgets(buf,sizeof(buf),fp) != NULL ){
-		if( sscanf(buf,"%lld %lld %s %lld %lld %lld %lld %lld",&major,&minor,device,&reads,&rmerge,&sectors,&read_time,&writes) == 8 ){
-			no_white(device);	// unlikely, but possible?
-			sprintf(tmp,"%s-read",device);
-			val_update_int(p,tmp,reads);
-			sprintf(tmp,"%s-write",device);
-			val_update_int(p,tmp,writes);
-			}
-		}
-	fclose(fp);
+// parse an interval like 10 (seconds), 2s or 250ms, return milliseconds or 0 if it isn't one
+static long
+parse_interval(const char *s)
+{
+	char *end;
+	long n = strtol(s,&end,10);
+
+	if( strcmp(end,"ms")==0 )
+		return n;
+	if( *end == '\0' || strcmp(end,"s")==0 )
+		return n*1000;
+	return 0;
 }
 
-void
-update_system(void)
+// -M size, in bytes or with a k, m or g after it
+static size_t
+parse_bytes(const char *s)
 {
-	proc_t *p = lookup_proc(0);
+	char *end;
+	unsigned long long int n = strtoull(s,&end,10);
 
-	val_update_str(p,"Name","KERNEL");
-	if(Memwatch){
-		update_system_slabinfo(p,"/proc/slabinfo");
-		update_system_meminfo(p,"/proc/meminfo");
-		update_system_vmstat(p,"/proc/vmstat");
+	switch(tolower(*end)){
+	case 'g': n *= 1024;	// fall through
+	case 'm': n *= 1024;	// fall through
+	case 'k': n *= 1024; end++; break;
 		}
-	if(Timewatch)
-		update_system_stat(p,"/proc/stat");
-	if(Yaffswatch)
-		update_system_yaffs(p,"/proc/yaffs");
-	if(Diskwatch)
-		update_system_disk(p,"/proc/diskstats");
+	return *end == '\0' ? n : 0;
 }
 
-void
-pause_for_next_pass(void)
+// work out which stat fields are worth converting
+static void
+stat_setup(void)
 {
-	int fd;
+	int f;
 
-	if( Externaltrigger ){
-		while( (fd=open(TRIGGER_FILE,O_RDONLY,0)) < 0 )
-			sleep(1);
-		close(fd);
-		unlink(TRIGGER_FILE);
-		}
-	else {
-		sleep(Update_interval);
-	}
+	if(Timewatch)
+		Stat_mask |= (1ULL<<STAT_UTIME)|(1ULL<<STAT_STIME)|(1ULL<<STAT_CUTIME)|(1ULL<<STAT_CSTIME);
+	if(Procwatch && Verbose)
+		Stat_mask |= (1ULL<<STAT_KSTKESP)|(1ULL<<STAT_KSTKEIP);
+	if(Procwatch)
+		Stat_mask |= (1ULL<<STAT_PRIORITY)|(1ULL<<STAT_FLAGS)|(1ULL<<STAT_NICE)
+			|(1ULL<<STAT_SIGNAL)|(1ULL<<STAT_BLOCKED)|(1ULL<<STAT_SIGIGNORE)|(1ULL<<STAT_SIGCATCH);
+	for(f=STAT_MAX; f>0; f--)
+		if( Stat_mask & (1ULL<<f) ){
+			Stat_last = f;
+			break;
+			}
 }
 
 static void
 usage(void)
 {
-	printf("Usage: hawk [-v] [-x] [-t] [-m] [-p] [-f] [-k] [-y] [-d]\n");
+	printf("Usage: hawk [-v] [-x] [-u] [-t] [-m] [-s] [-p] [-f] [-k] [-y] [-d] [-j N] [-B] [-w] [-e] [-a] [-L N [-g P]] [-q] [-S dir] [-R dir] [-c N] [-K N] [-M bytes] [-i] [-I] [-P pid] [-n name] [-U uid] [-C cgroup]\n");
 	printf(" -t watch time\n");
 	printf(" -m watch memory\n");
+	printf(" -s add Rss/Pss/Swap totals from smaps_rollup (implies -m)\n");
 	printf(" -p watch process\n");
 	printf(" -f watch files\n");
 	printf(" -k watch kernel activity\n");
@@ -844,16 +4103,58 @@ usage(void)
 	printf(" -d watch disk activity (implies -k)\n");
 	printf(" -v verbose\n");
 	printf(" -x external trigger by file (%s)\n",TRIGGER_FILE);
+	printf(" -u external trigger by SIGUSR1\n");
+	printf(" -j N scan /proc with N threads\n");
+	printf(" -B binary output, see hawk-decode\n");
+	printf(" -w write output from a separate thread, up to 4 passes behind\n");
+	printf(" -e follow process fork/exec/exit events as they happen (needs root)\n");
+	printf(" -a read processes less often while they don't change\n");
+	printf(" -L N say LEAK? for values that went up N times without going down\n");
+	printf(" -g P  ... and by at least P %% an hour (default 1)\n");
+	printf(" -q only print LEAK? lines\n");
+	printf(" -S dir also keep every integer value's history in a store in dir, see hawk-query\n");
+	printf(" -R dir look in dir instead of /proc, such as a tree made by bench/hawk-bench\n");
+	printf(" -c N stop after N passes\n");
+	printf(" -K N read only the N fastest growing processes in full, the rest just for\n");
+	printf("  VmRSS, FdCount and Threads\n");
+	printf(" -M bytes keep at most this much about processes (k, m or g after it for more),\n");
+	printf("  dropping fds and maps, then whole processes, of those unchanged longest;\n");
+	printf("  an evicted process comes back when its VmRSS or fds move\n");
+	printf(" -i show what each pass cost hawk as a HAWK process\n");
+	printf(" -I read /proc files through io_uring, a batch of processes at a time\n");
+	printf(" -P pid, -n name, -U uid, -C cgroup only look at processes with this pid, name\n");
+	printf("  or user, or in this cgroup.  Names and cgroups are globs, ! in front excludes\n");
+	printf(" N seconds between passes, or Nms for milliseconds (default 10)\n");
 	printf("Default is -m -f\n");
 	exit(1);
 }
 
-static inline void
-handle_args(char *s)
+// value for a flag, either the rest of this arg (-j4) or the next one (-j 4)
+static inline char *
+flag_value(char **s, char *next, int *used)
+{
+	char *val = *s;
+
+	if( *val == '\0' ){
+		if( next == NULL || *used )
+			usage();
+		val = next;
+		*used = 1;
+		}
+	*s += strlen(*s);
+	return val;
+}
+
+// handle one arg, return 1 if the next arg was used up as a flag value
+static inline int
+handle_args(char *s, char *next)
 {
+	int used = 0;
+
 	if( isdigit(*s) ){
-		Update_interval=atoi(s);
-		return;
+		if( (Update_interval=parse_interval(s)) <= 0 )
+			usage();
+		return 0;
 		}
 	if( *s == '-' ){
 		while( *s ){
@@ -861,63 +4162,160 @@ handle_args(char *s)
 			case 'v': Verbose=true; break;
 			case 't': Timewatch=true; break;
 			case 'm': Memwatch=true; break;
+			case 's': Smapswatch=Memwatch=true; break;
 			case 'p': Procwatch=true; break;
 			case 'f': Filewatch=true; break;
 			case 'k': Kernelwatch=true; break;
 			case 'y': Yaffswatch=Kernelwatch=true; break;
 			case 'd': Diskwatch=Kernelwatch=true; break;
 			case 'x': Externaltrigger=true; break;
+			case 'u': Sigtrigger=true; break;
+			case 'j': Nthreads=atoi(flag_value(&s,next,&used)); break;
+			case 'B': Binary=true; break;
+			case 'w': Bgwrite=true; break;
+			case 'e': Events=true; break;
+			case 'a': Adaptive=true; break;
+			case 'L': Leak_run=atoi(flag_value(&s,next,&used)); break;
+			case 'g': Leak_growth=atof(flag_value(&s,next,&used)); break;
+			case 'q': Quiet=true; break;
+			case 'S': Store_dir=flag_value(&s,next,&used); break;
+			case 'R': Proc_root=flag_value(&s,next,&used); break;
+			case 'c': Passes=atoi(flag_value(&s,next,&used)); break;
+			case 'K': Topk=atoi(flag_value(&s,next,&used)); break;
+			case 'M': if( (Mem_budget=parse_bytes(flag_value(&s,next,&used))) == 0 ) usage(); break;
+			case 'i': Selfwatch=true; break;
+			case 'I': Uring=true; break;
+			case 'P': filter_add(FILT_PID,flag_value(&s,next,&used)); break;
+			case 'n': filter_add(FILT_NAME,flag_value(&s,next,&used)); break;
+			case 'U': filter_add(FILT_UID,flag_value(&s,next,&used)); break;
+			case 'C': filter_add(FILT_CGROUP,flag_value(&s,next,&used)); break;
 			case '-': break;
 			default: usage(); break;
 				}
 			}
-		return;
+		return used;
 		}
 	usage();
+	return 0;
 }
 
 int
 main(int argc, char **argv)
 {
-	int pid;
+	int pid, i;
+	proc_t *p;
 	DIR *d;
 	struct dirent *v;
-	int hawk_pid = getpid();
-	proc_t *p;
-	char pdir[BUFSIZE];
+	struct rlimit rl;
+	struct iovec magic = { HAWKBIN_MAGIC, HAWKBIN_MAGICLEN };
+	pthread_t wtid;
+	struct timespec now;
+	long long int t;
 
-	while(--argc)
-		handle_args(*++argv);
+	Hawk_pid = getpid();
+	clock_gettime(CLOCK_MONOTONIC,&Pass_mono);
+	for(i=1; i<argc; i++)
+		i += handle_args(argv[i],argv[i+1]);
 
 	if(Timewatch==0 && Memwatch==0 && Procwatch==0 && Filewatch==0 && Kernelwatch==0 && Yaffswatch==0)
 		Memwatch=Filewatch=1;	// default to -m -f
-	setbuf(stdout,NULL);
+	stat_setup();
+	if( Store_dir )
+		store_open();
+	status_setup();
+	if( Externaltrigger || Sigtrigger )	// before any threads, which must not get SIGUSR1
+		trigger_setup();
+	else
+		timer_setup();
+	Out = &Passout;
+	if( Binary )
+		write_all(&magic,1);
+	if( Bgwrite && pthread_create(&wtid,NULL,writer_thread,NULL) != 0 )
+		Bgwrite = false;	// write passes ourselves
+
+	// hold /proc files open between passes, leaving some fds for everything else
+	if( getrlimit(RLIMIT_NOFILE,&rl) == 0 ){
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE,&rl);
+		getrlimit(RLIMIT_NOFILE,&rl);
+		if( rl.rlim_cur > FD_RESERVE )
+			Fd_keepmax = rl.rlim_cur > 0x7fffffff ? 0x7fffffff : rl.rlim_cur - FD_RESERVE;
+		}
 	if( nice(10) < 0 )
-		printf("not nice\n");
+		out("not nice\n");
+	if( Events && !events_open() )
+		out("no process events, scanning /proc\n");
+	if( Uring && (Ur=uring_open()) == NULL ){
+		Uring = false;
+		out("no io_uring, reading /proc files one at a time\n");
+		}
+	if( Uring && Nthreads > 1 && (Worker_ur=(uring_t **)calloc(Nthreads-1,sizeof(*Worker_ur))) == NULL ){
+		printf("Out of memory\n");
+		exit(1);
+		}
 
 	for(Pass=0;;Pass++){
 		Pass_printed = false;
+		if( Store_broken )
+			store_close();
+		clock_gettime(CLOCK_MONOTONIC,&Pass_mono);
+		if( Store_dir ){
+			clock_gettime(CLOCK_REALTIME,&now);
+			Store_ms = now.tv_sec*1000LL + now.tv_nsec/1000000;
+			}
+		if( Selfwatch )
+			update_self();
+		t = self_clock();
 		if(Kernelwatch)
 			update_system();
-		d = opendir("/proc");
-		if( d != NULL ){
+		t = self_time(SELF_SYSTEM,t);
+		Nscan = 0;
+		if( Evfd >= 0 && !Events_lost ){
+			// events keep the proc list up to date, just revisit it in the order readdir would give
+			for(p=Phead.pnext; p != &Phead; p=p->pnext)
+				if( p->pid != 0 && p->pid != (unsigned int)Hawk_pid ){
+					p->lastupdate = Pass;
+					scan_add(p);
+					}
+			qsort(Scan,Nscan,sizeof(*Scan),proc_pid_cmp);
+			}
+		else if( (d=opendir(Proc_root)) != NULL ){
+			Events_lost = false;
 			while( (v=readdir(d)) ){
 				// only look at process directories
 				pid = strtol(v->d_name,NULL,10);
-				if( pid <= 0 || pid == hawk_pid)
+				if( pid <= 0 || pid == Hawk_pid)
 					continue;
-				p = lookup_proc(pid);
-				if( !p->isclone ){
-					sprintf(pdir,"/proc/%d",p->pid);
-					if( chdir(pdir) >= 0 )	// chdir may fail if process exited since readdir saw it
-						update_user(p);
-					}
+				if( Nfilters && !filter_pass(pid,v->d_ino) )
+					continue;
+				scan_add(lookup_proc(pid));
 				}
 			closedir(d);
+			if( Nfilters )
+				filter_pass_end();
 			}
-		clone_check();
+		scan_all();
+		t = self_time(SELF_SCAN,t);
+		if( Topk )	// clone_check() would take the processes not read in full for clones
+			topk_select();
+		else
+			clone_check();
+		t = self_time(SELF_CLONE,t);
 		cleanup();
+		budget_check();
+		val_sweep();
+		t = self_time(SELF_CLEANUP,t);
+		pass_flush();
+		t = self_time(SELF_OUTPUT,t);
+		if( Selfwatch ){
+			Self[SELF_PASS] += t - (Pass_mono.tv_sec*1000000000LL + Pass_mono.tv_nsec);
+			self_merge();
+			}
+		if( Passes && Pass+1 >= Passes )
+			break;
 		pause_for_next_pass();
 		}
+	if( Bgwrite )
+		writer_drain();
 	exit(0);
 }
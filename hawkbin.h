@@ -0,0 +1,79 @@
+//	hawkbin.h --- hawk -B binary record stream, shared by hawk and hawk-decode
+
+#include <stdbool.h>
+
+// The stream starts with HAWKBIN_MAGIC, then one block per pass that had output:
+//	varint	payload length
+//	varint	pass number
+//	varint	time(), as printed in the text pass header
+//	varint	CLOCK_MONOTONIC at the start of the pass, in milliseconds
+//	varint	ticks missed because the previous pass overran
+//	records, each a tag byte followed by its fields
+//
+// Value names are sent once as REC_NAME and referred to by id after that.
+// Process pids are set with REC_PID and apply to the records that follow.
+// Integer changes are sent as a zigzag delta from the last value printed for
+// that pid and name, so the decoder keeps those to rebuild the text.
+
+#define	HAWKBIN_MAGIC	"HAWKBIN2"
+#define	HAWKBIN_MAGICLEN	8
+
+#define	REC_NAME	'N'	// varint id, varint len, name
+#define	REC_PID		'S'	// varint pid
+#define	REC_NEW		'n'	// byte shown, process appeared
+#define	REC_EXIT	'x'	// byte shown, process went away
+#define	REC_CLONE	'c'	// varint percent, varint pid of original
+#define	REC_INT		'i'	// byte flags, varint name id, zigzag value (delta unless REC_UNDEF)
+#define	REC_STR		's'	// byte flags, varint name id, varint len, new value as given
+#define	REC_TEXT	't'	// varint len, text printed as is
+#define	REC_LINE	'l'	// varint len, text printed as is after the pass header
+#define	REC_MAP		'm'	// byte flags, varint start, varint old end unless REC_UNDEF, varint new end unless REC_GONE
+
+#define	REC_UNDEF	0x01	// flag: old value was undefined
+#define	REC_GONE	0x02	// flag: new value is undefined
+
+static inline unsigned long long int
+zigzag(long long int v)
+{
+	return ((unsigned long long int)v << 1) ^ (unsigned long long int)(v >> 63);
+}
+
+static inline long long int
+unzigzag(unsigned long long int v)
+{
+	return (long long int)(v >> 1) ^ -(long long int)(v & 1);
+}
+
+// store v as a little endian base 128 varint, return bytes used (at most 10)
+static inline int
+put_varint(unsigned char *s, unsigned long long int v)
+{
+	int n = 0;
+
+	while( v >= 0x80 ){
+		s[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+		}
+	s[n++] = v;
+	return n;
+}
+
+// read a varint from *sp, not going past end, return false if it runs off the end
+static inline bool
+get_varint(const unsigned char **sp, const unsigned char *end, unsigned long long int *v)
+{
+	const unsigned char *s = *sp;
+	unsigned long long int r = 0;
+	int shift = 0;
+
+	while( s < end && shift < 64 ){
+		r |= (unsigned long long int)(*s & 0x7f) << shift;
+		if( (*s++ & 0x80) == 0 ){
+			*sp = s;
+			*v = r;
+			return true;
+			}
+		shift += 7;
+		}
+	return false;
+}
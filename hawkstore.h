@@ -0,0 +1,41 @@
+//	hawkstore.h --- hawk -S time series store, shared by hawk and hawk-query
+
+// A store is a directory holding two files:
+//	hawk.idx	store_ent_t records, only ever appended to
+//	hawk.dat	STORE_SEGSIZE byte segments, each holding the samples of one series
+//
+// A series is one integer value of one process.  It starts with a STORE_SERIES
+// entry giving the pid and value name, and its id is the number of that entry
+// in the index.  Each time a series fills a segment the next one is taken from
+// the end of hawk.dat and a STORE_SEG entry says whose it is, so the samples
+// of a series are in the segments of its STORE_SEG entries, in index order.
+// hawk.dat grows STORE_EXTENT at a time and unused samples are all zero.
+//
+// A sample is only stored when the value changes, the first one is always
+// stored, and the value holds until the next sample.  When the value or its
+// process goes away (or hawk stops watching the process), a last sample with
+// val STORE_GONE ends the series.
+
+#define	STORE_INDEX	"hawk.idx"
+#define	STORE_DATA	"hawk.dat"
+#define	STORE_SEGSIZE	4096			// bytes per segment
+#define	STORE_EXTENT	(256*STORE_SEGSIZE)	// bytes hawk.dat grows and is mapped by
+#define	STORE_NAMELEN	100			// room for a value name and its 0
+
+#define	STORE_SERIES	1
+#define	STORE_SEG	2
+
+typedef struct store_ent {
+	unsigned int	kind;			// STORE_SERIES or STORE_SEG
+	unsigned int	series;			// STORE_SEG: id of the series the segment belongs to
+	unsigned int	n;			// STORE_SERIES: pid, STORE_SEG: segment number in hawk.dat
+	char		name[STORE_NAMELEN];	// STORE_SERIES: value name
+} store_ent_t;
+
+typedef struct store_sample {
+	long long int	ms;			// CLOCK_REALTIME of the pass in milliseconds, 0 if unused
+	long long int	val;
+} store_sample_t;
+
+#define	STORE_SAMPLES	(STORE_SEGSIZE/sizeof(store_sample_t))	// samples per segment
+#define	STORE_GONE	(-0x7fffffffffffffffLL-1)		// val of the sample ending a series